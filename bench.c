@@ -0,0 +1,273 @@
+#include "deflate.h"
+#include <time.h>
+#include <malloc.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+// Benchmark
+// Compresses and decompresses a corpus at every level, and reports speed, ratio, cycles per byte and
+// how much memory each level took. The corpus is generated here from a fixed seed, so every run and every
+// commit measures the same bytes.
+// usage: bench [-s megabytes per corpus] [-r repeats] [-l level] [-c]
+// -c writes CSV instead of a table, so runs can be compared:
+//   ./bench -c > before.csv
+
+struct corpus {
+    const char *name;
+    unsigned char *data;
+    size_t len;
+};
+
+// xorshift, so the corpus is the same everywhere
+static uint64_t next_random(uint64_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+static const char *words[] = {
+    "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by", "on",
+    "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had", "they",
+    "you", "were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if", "more", "when",
+    "will", "would", "who", "so", "no", "compression", "window", "repetition", "huffman", "literal",
+    "distance", "block", "stream", "decoder", "encoder", "dictionary", "checksum", "benchmark",
+};
+#define WORDS (sizeof(words) / sizeof(words[0]))
+
+// english-like text: short words are a lot more common than long ones
+static void make_text(unsigned char *out, size_t len, uint64_t *seed) {
+    size_t i = 0;
+    while (i < len) {
+        uint64_t r = next_random(seed);
+        // squaring a random fraction makes the first words the common ones
+        size_t k = ((r & 0xffff) * (r & 0xffff) >> 16) * WORDS >> 16;
+        const char *word = words[k];
+        for (size_t j = 0; word[j] != '\0' && i < len; j++) {
+            out[i++] = word[j];
+        }
+        if (i < len) {
+            out[i++] = (r >> 20) % 13 == 0 ? '\n' : (r >> 20) % 7 == 0 ? ',' : ' ';
+        }
+    }
+}
+
+// log lines with timestamps, levels, and ids
+static void make_logs(unsigned char *out, size_t len, uint64_t *seed) {
+    static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+    static const char *messages[] = {
+        "request served", "cache miss", "connection opened", "connection closed", "retrying upstream",
+        "slow query", "user logged in", "session expired",
+    };
+    size_t i = 0;
+    uint64_t time = 1700000000000;
+    char line[256];
+    while (i < len) {
+        uint64_t r = next_random(seed);
+        time += r % 1000;
+        int n = snprintf(line, sizeof(line), "%llu.%03llu [%s] worker-%d %s id=%08llx latency=%dms\n",
+                         (unsigned long long)(time / 1000), (unsigned long long)(time % 1000),
+                         levels[(r >> 10) % 6], (int)((r >> 14) % 16), messages[(r >> 18) % 8],
+                         (unsigned long long)((r >> 24) & 0xffffffff), (int)((r >> 56) % 250));
+        for (int j = 0; j < n && i < len; j++) {
+            out[i++] = line[j];
+        }
+    }
+}
+
+// fixed size records of little endian numbers which change a little from one to the next, like a table
+static void make_binary(unsigned char *out, size_t len, uint64_t *seed) {
+    uint32_t fields[4] = { 1000, 50000, 7, 123456789 };
+    size_t i = 0;
+    while (i < len) {
+        uint64_t r = next_random(seed);
+        fields[0] += 1;
+        fields[1] += (r & 0xff) - 120;
+        fields[2] = (r >> 8) % 5;
+        fields[3] ^= (r >> 16) & 0x3;
+        for (int f = 0; f < 4; f++) {
+            for (int b = 0; b < 4 && i < len; b++) {
+                out[i++] = fields[f] >> (8 * b);
+            }
+        }
+    }
+}
+
+// random bytes, like data which is already compressed or encrypted
+static void make_random(unsigned char *out, size_t len, uint64_t *seed) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = next_random(seed) >> 32;
+    }
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void) {
+#ifdef __x86_64__
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// a field of /proc/self/status in kilobytes, or -1 where there is none
+static long status_kb(const char *name) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    size_t name_len = strlen(name);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            kb = atol(line + name_len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// the peak resident memory only ever grows, so it's put back to what's resident now before each level,
+// and what the level added is the peak afterwards less the resident memory before it
+static long start_peak(void) {
+    // memory a level before this one freed is handed back, so it isn't counted as already resident
+    malloc_trim(0);
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (f == NULL) {
+        return -1;
+    }
+    bool reset = fputs("5", f) >= 0;
+    if (fclose(f) != 0 || !reset) {
+        return -1;
+    }
+    return status_kb("VmRSS");
+}
+
+// what the process's resident memory grew by since start_peak, in kilobytes, or -1 where it can't be told
+static long peak_since(long start) {
+    long peak = status_kb("VmHWM");
+    return start < 0 || peak < 0 ? -1 : peak - start;
+}
+
+int main(int argc, char **argv) {
+    size_t megabytes = 4;
+    int repeats = 3;
+    int only_level = 0;
+    bool csv = false;
+    int option;
+    while ((option = getopt(argc, argv, "s:r:l:c")) != -1) {
+        switch (option) {
+            case 's': megabytes = atol(optarg); break;
+            case 'r': repeats = atoi(optarg); break;
+            case 'l': only_level = atoi(optarg); break;
+            case 'c': csv = true; break;
+            default:
+                fprintf(stderr, "usage: bench [-s megabytes] [-r repeats] [-l level] [-c]\n");
+                return 1;
+        }
+    }
+    if (repeats < 1) repeats = 1;
+
+    size_t len = megabytes << 20;
+    struct corpus corpora[] = {
+        { "text", NULL, len }, { "logs", NULL, len }, { "binary", NULL, len },
+        { "random", NULL, len }, { "zeros", NULL, len },
+    };
+    size_t count = sizeof(corpora) / sizeof(corpora[0]);
+    uint64_t seed = 0x2545f4914f6cdd1d;
+    for (size_t k = 0; k < count; k++) {
+        corpora[k].data = calloc(len, 1);
+        if (corpora[k].data == NULL) {
+            return ERR_NO_MEMORY;
+        }
+    }
+    make_text(corpora[0].data, len, &seed);
+    make_logs(corpora[1].data, len, &seed);
+    make_binary(corpora[2].data, len, &seed);
+    make_random(corpora[3].data, len, &seed);
+
+    size_t cap = deflate_compress_bound(len);
+    unsigned char *compressed = malloc(cap);
+    unsigned char *decompressed = malloc(len);
+    if (compressed == NULL || decompressed == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    // the buffers are touched here, so the first level isn't the one which pays for them
+    memset(compressed, 0, cap);
+    memset(decompressed, 0, len);
+
+    if (csv) {
+        printf("corpus,level,bytes,compressed,ratio,compress_mbs,decompress_mbs,compress_cpb,decompress_cpb,memory_kb\n");
+    } else {
+        printf("%-7s %5s %10s %10s %7s %10s %10s %9s %9s %10s\n", "corpus", "level", "bytes", "compressed",
+               "ratio", "comp MB/s", "dec MB/s", "comp c/B", "dec c/B", "memory");
+    }
+    int failed = 0;
+    for (size_t k = 0; k < count; k++) {
+        for (int level = 1; level <= MAX_LEVEL; level++) {
+            if (only_level != 0 && level != only_level) {
+                continue;
+            }
+            long resident = start_peak();
+            struct compressor_context *c = compressor_context_new(level, MAX_WINDOW_BITS);
+            if (c == NULL) {
+                return ERR_NO_MEMORY;
+            }
+            // the fastest of the repeats, which is the least disturbed by everything else
+            double compress_time = 1e9, decompress_time = 1e9;
+            uint64_t compress_cycles = UINT64_MAX, decompress_cycles = UINT64_MAX;
+            size_t compressed_len = 0, decompressed_len = 0;
+            int result = 0;
+            for (int r = 0; r < repeats && result == 0; r++) {
+                double start = now();
+                uint64_t start_cycles = cycles();
+                result = compressor_context_compress(c, corpora[k].data, len, compressed, cap, &compressed_len);
+                uint64_t spent_cycles = cycles() - start_cycles;
+                double spent = now() - start;
+                if (spent < compress_time) compress_time = spent;
+                if (spent_cycles < compress_cycles) compress_cycles = spent_cycles;
+            }
+            for (int r = 0; r < repeats && result == 0; r++) {
+                double start = now();
+                uint64_t start_cycles = cycles();
+                result = deflate_decompress_buffer(compressed, compressed_len, decompressed, len, &decompressed_len);
+                uint64_t spent_cycles = cycles() - start_cycles;
+                double spent = now() - start;
+                if (spent < decompress_time) decompress_time = spent;
+                if (spent_cycles < decompress_cycles) decompress_cycles = spent_cycles;
+            }
+            compressor_context_free(c);
+            long memory = peak_since(resident);
+            if (result != 0 || decompressed_len != len || memcmp(decompressed, corpora[k].data, len) != 0) {
+                fprintf(stderr, "%s level %d: round trip failed (%d)\n", corpora[k].name, level, result);
+                failed = 1;
+                continue;
+            }
+            double ratio = (double)len / compressed_len;
+            double compress_speed = len / compress_time / 1e6, decompress_speed = len / decompress_time / 1e6;
+            double compress_cpb = (double)compress_cycles / len, decompress_cpb = (double)decompress_cycles / len;
+            if (csv) {
+                printf("%s,%d,%zu,%zu,%.4f,%.2f,%.2f,%.3f,%.3f,%ld\n", corpora[k].name, level, len, compressed_len,
+                       ratio, compress_speed, decompress_speed, compress_cpb, decompress_cpb, memory);
+            } else {
+                printf("%-7s %5d %10zu %10zu %7.3f %10.2f %10.2f %9.2f %9.2f %8ldKB\n", corpora[k].name, level, len,
+                       compressed_len, ratio, compress_speed, decompress_speed, compress_cpb, decompress_cpb,
+                       memory);
+            }
+            fflush(stdout);
+        }
+    }
+    for (size_t k = 0; k < count; k++) {
+        free(corpora[k].data);
+    }
+    free(compressed);
+    free(decompressed);
+    return failed;
+}
@@ -0,0 +1,105 @@
+#ifndef GUARD_b7eee31c_c073_4a8e_adec_d017c98b3d28
+#define GUARD_b7eee31c_c073_4a8e_adec_d017c98b3d28
+#include "deflate.h"
+// Reads deflate's bit stream from a buffer, through a 64-bit accumulator.
+// Bits are peeked and consumed separately, so table decoders can look at the next bits
+// before they know how many of them belong to the code.
+struct bitreader {
+    const unsigned char *next; // next input byte which isn't in bit_buf
+    const unsigned char *end;  // end of input
+    uint64_t bit_buf;          // bits waiting to be consumed, the next one is the lowest
+    int bit_count;             // number of bits in bit_buf
+};
+
+static inline void bitreader_init(struct bitreader *br, const void *in, size_t in_len) {
+    br->next = in;
+    br->end = br->next + in_len;
+    br->bit_buf = 0;
+    br->bit_count = 0;
+}
+
+// number of input bytes which aren't in the bit buffer yet
+static inline size_t bitreader_avail(const struct bitreader *br) {
+    return br->end - br->next;
+}
+
+// fills the bit buffer to at least 56 bits, with a single unaligned load and no bounds checks.
+// needs at least 8 bytes of input left.
+// the bytes above bit_count may already be loaded, which is fine, because loading them again
+// ORs the same bits into the same place
+static inline void bitreader_refill_fast(struct bitreader *br) {
+    uint64_t word;
+    memcpy(&word, br->next, 8);
+    br->bit_buf |= le64toh(word) << br->bit_count;
+    br->next += (63 - br->bit_count) >> 3;
+    br->bit_count |= 56;
+}
+
+// fills the bit buffer byte by byte until it has count bits
+// returns false if the input ended first
+static inline bool bitreader_fill(struct bitreader *br, int count) {
+    while (br->bit_count < count) {
+        if (br->next == br->end) {
+            return false;
+        }
+        br->bit_buf |= (uint64_t)(*br->next++) << br->bit_count;
+        br->bit_count += 8;
+    }
+    return true;
+}
+
+// makes sure there are at least count (at most 56) bits in the bit buffer
+// returns false if the input ended first
+static inline bool bitreader_refill(struct bitreader *br, int count) {
+    if (bitreader_avail(br) >= 8) {
+        bitreader_refill_fast(br);
+        return true;
+    }
+    return bitreader_fill(br, count);
+}
+
+// returns the next count bits without consuming them
+static inline uint32_t bitreader_peek(const struct bitreader *br, int count) {
+    return (uint32_t)(br->bit_buf & ((1ULL << count) - 1));
+}
+
+// consumes count bits, which must be in the bit buffer
+static inline void bitreader_consume(struct bitreader *br, int count) {
+    br->bit_buf >>= count;
+    br->bit_count -= count;
+}
+
+// returns and consumes the next count bits, which must be in the bit buffer
+static inline uint32_t bitreader_bits(struct bitreader *br, int count) {
+    uint32_t value = bitreader_peek(br, count);
+    bitreader_consume(br, count);
+    return value;
+}
+
+// skips to the next byte boundary
+static inline void bitreader_align(struct bitreader *br) {
+    bitreader_consume(br, br->bit_count & 7);
+}
+
+// copies up to len bytes from a byte boundary: first the whole bytes in the bit buffer,
+// then straight from the input with memcpy
+// returns the number of bytes copied
+static inline size_t bitreader_copy(struct bitreader *br, unsigned char *dest, size_t len) {
+    size_t copied = 0;
+    while (br->bit_count >= 8 && copied < len) {
+        dest[copied++] = bitreader_bits(br, 8);
+    }
+    if (br->bit_count == 0) {
+        // drop any bytes which were loaded ahead, they are copied from the input below
+        br->bit_buf = 0;
+        size_t span = bitreader_avail(br);
+        if (span > len - copied) {
+            span = len - copied;
+        }
+        memcpy(dest + copied, br->next, span);
+        br->next += span;
+        copied += span;
+    }
+    return copied;
+}
+#endif
@@ -0,0 +1,709 @@
+#include "deflate.h"
+
+// Regression checks
+// Every check is a case which once went wrong. make check builds and runs them, and the exit status is
+// the number which failed.
+
+static int failed = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failed++; \
+    } \
+} while (0)
+
+// a dictionary smaller than a segment has no epochs to pick segments in
+static void check_small_dictionary(void) {
+    static unsigned char samples[5000];
+    size_t sample_lens[5];
+    for (size_t i = 0; i < sizeof(samples); i++) {
+        samples[i] = "the quick brown fox jumps over the lazy dog"[i % 43] ^ (i / 1000);
+    }
+    for (int i = 0; i < 5; i++) {
+        sample_lens[i] = 1000;
+    }
+    for (size_t cap = 0; cap <= 64; cap += 16) {
+        unsigned char dict[64];
+        size_t dict_len = SIZE_MAX;
+        CHECK(deflate_dictionary_build(samples, sample_lens, 5, dict, cap, &dict_len) == 0);
+        CHECK(dict_len <= cap);
+    }
+}
+
+// greedy levels skip the inside of long repetitions, but their start still has to reach the hash chains,
+// or the chains stop moving forward and long runs are found far back
+static void check_greedy_runs(void) {
+    size_t len = 1 << 20;
+    unsigned char *zeros = calloc(len, 1);
+    size_t cap = deflate_compress_bound(len);
+    unsigned char *out = malloc(cap);
+    CHECK(zeros != NULL && out != NULL);
+    if (zeros != NULL && out != NULL) {
+        for (int level = 1; level <= 3; level++) {
+            struct compressor_context *c = compressor_context_new(level, MAX_WINDOW_BITS);
+            size_t out_len = 0;
+            CHECK(c != NULL && compressor_context_compress(c, zeros, len, out, cap, &out_len) == 0);
+            CHECK(out_len < 6000);
+            compressor_context_free(c);
+        }
+    }
+    free(zeros);
+    free(out);
+}
+
+// the buffer functions run on threads with small stacks, when the compressor's hash chains are given to it
+static void *compress_on_small_stack(void *workspace) {
+    static unsigned char in[100000], out[120000], back[100000];
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = "abcdefghij"[(i * 7 + i / 100) % 10];
+    }
+    size_t out_len = 0, back_len = 0;
+    CHECK(deflate_compress_buffer_workspace(in, sizeof(in), out, sizeof(out), &out_len, workspace) == 0);
+    CHECK(deflate_decompress_buffer(out, out_len, back, sizeof(back), &back_len) == 0);
+    CHECK(back_len == sizeof(in) && memcmp(in, back, back_len) == 0);
+    return NULL;
+}
+
+static void check_small_stack(void) {
+    void *workspace = malloc(DEFLATE_COMPRESS_WORKSPACE_SIZE);
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    CHECK(workspace != NULL && pthread_create(&thread, &attr, compress_on_small_stack, workspace) == 0);
+    if (workspace != NULL) {
+        pthread_join(thread, NULL);
+    }
+    pthread_attr_destroy(&attr);
+    free(workspace);
+}
+
+// a batch job reads ahead, and leaves a regular file right after the data, so what follows can be read
+static void check_batch_position(void) {
+    size_t len = 300000;
+    unsigned char *in = malloc(len);
+    size_t cap = deflate_compress_bound(len);
+    unsigned char *compressed = malloc(cap);
+    FILE *file = tmpfile();
+    struct deflate_batch *b = deflate_batch_new(1);
+    CHECK(in != NULL && compressed != NULL && file != NULL && b != NULL);
+    if (in != NULL && compressed != NULL && file != NULL && b != NULL) {
+        uint32_t seed = 1;
+        for (size_t i = 0; i < len; i++) {
+            seed = seed * 1103515245 + 12345;
+            in[i] = 'a' + (seed >> 16) % 16;
+        }
+        size_t compressed_len = 0;
+        CHECK(deflate_compress_buffer(in, len, compressed, cap, &compressed_len) == 0);
+        CHECK(fwrite(compressed, 1, compressed_len, file) == compressed_len && fwrite("after", 1, 5, file) == 5);
+        fflush(file);
+        int fd = fileno(file);
+        lseek(fd, 0, SEEK_SET);
+        struct deflate_memory out = { NULL, 0, 0 };
+        struct deflate_batch_job job = { fd, deflate_sink_memory(&out), FORMAT_RAW, 0, NULL, NULL };
+        deflate_batch_submit(b, &job);
+        CHECK(deflate_batch_next(b, true) == &job && job.result == 0);
+        CHECK(out.len == len && memcmp(out.data, in, len) == 0);
+        char after[8];
+        CHECK(read(fd, after, sizeof(after)) == 5 && memcmp(after, "after", 5) == 0);
+        free(out.data);
+    }
+    if (b != NULL) deflate_batch_free(b);
+    if (file != NULL) fclose(file);
+    free(in);
+    free(compressed);
+}
+
+// a file with in_len bytes of in, to read from the start
+static FILE *file_of(const unsigned char *in, size_t in_len) {
+    FILE *file = tmpfile();
+    if (file != NULL && fwrite(in, 1, in_len, file) != in_len) {
+        fclose(file);
+        return NULL;
+    }
+    if (file != NULL) rewind(file);
+    return file;
+}
+
+// decompresses a whole file of format from memory, with the dictionary if it isn't NULL
+static int decompress_file(const unsigned char *in, size_t in_len, int format, const void *dict, size_t dict_len,
+                           struct deflate_memory *out) {
+    FILE *file = file_of(in, in_len);
+    if (file == NULL) {
+        return ERR_WRITE;
+    }
+    struct deflate_sink sink = deflate_sink_memory(out);
+    int result = decompressor_sink_dict(&sink, file, format, dict, dict_len);
+    fclose(file);
+    return result;
+}
+
+// decompresses a whole gzip file from memory
+static int gunzip(const unsigned char *in, size_t in_len, struct deflate_memory *out) {
+    return decompress_file(in, in_len, FORMAT_GZIP, NULL, 0, out);
+}
+
+// writes a gzip member of len bytes of data, whose deflate data is body, with the header crc if it's
+// at least 0. returns the length of the member
+static size_t gzip_member(unsigned char *out, const unsigned char *data, size_t len,
+                          const unsigned char *body, size_t body_len, int header_crc) {
+    static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+    size_t n = sizeof(header);
+    memcpy(out, header, n);
+    if (header_crc >= 0) {
+        out[3] = 0x02;
+        out[n++] = header_crc;
+        out[n++] = header_crc >> 8;
+    }
+    memcpy(out + n, body, body_len);
+    n += body_len;
+    uint32_t crc = crc32_update(CRC32_INIT, data, len);
+    for (int i = 0; i < 4; i++) {
+        out[n++] = crc >> (8 * i);
+    }
+    for (int i = 0; i < 4; i++) {
+        out[n++] = len >> (8 * i);
+    }
+    return n;
+}
+
+// the gzip header crc is checked, and a member can't repeat the one before it
+static void check_gzip_members(void) {
+    static unsigned char data[3000], body[4000], file[16000];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = "gzip members"[i % 12] + i / 256;
+    }
+    size_t body_len = 0;
+    CHECK(deflate_compress_buffer(data, sizeof(data), body, sizeof(body), &body_len) == 0);
+    unsigned char header[10] = { 0x1f, 0x8b, 8, 0x02, 0, 0, 0, 0, 0, 0xff };
+    int header_crc = crc32_update(CRC32_INIT, header, sizeof(header)) & 0xffff;
+    struct deflate_memory out = { NULL, 0, 0 };
+    size_t len = gzip_member(file, data, sizeof(data), body, body_len, header_crc);
+    CHECK(gunzip(file, len, &out) == 0 && out.len == sizeof(data));
+    free(out.data);
+    out = (struct deflate_memory){ NULL, 0, 0 };
+    len = gzip_member(file, data, sizeof(data), body, body_len, header_crc ^ 1);
+    CHECK(gunzip(file, len, &out) == ERR_BAD_CHECKSUM);
+    free(out.data);
+
+    // the second member is the same data again, compressed with the first as its dictionary
+    struct compressor_context *c = compressor_context_new(DEFAULT_LEVEL, MAX_WINDOW_BITS);
+    unsigned char repeated[64];
+    size_t repeated_len = 0;
+    CHECK(c != NULL && compressor_context_set_dictionary(c, data, sizeof(data)) == 0 &&
+          compressor_context_compress(c, data, sizeof(data), repeated, sizeof(repeated), &repeated_len) == 0);
+    compressor_context_free(c);
+    len = gzip_member(file, data, sizeof(data), body, body_len, -1);
+    len += gzip_member(file + len, data, sizeof(data), repeated, repeated_len, -1);
+    out = (struct deflate_memory){ NULL, 0, 0 };
+    CHECK(gunzip(file, len, &out) == ERR_INVALID_DEFLATE);
+    free(out.data);
+}
+
+// a read error isn't the end of the input, or the output would be cut short without an error
+static void check_read_error(void) {
+    // reading a directory fails
+    FILE *src = fopen("/", "rb");
+    CHECK(src != NULL);
+    if (src != NULL) {
+        struct deflate_memory out = { NULL, 0, 0 };
+        struct deflate_sink sink = deflate_sink_memory(&out);
+        CHECK(compressor_sink(&sink, src, DEFAULT_LEVEL, FORMAT_GZIP) == ERR_READ);
+        free(out.data);
+        fclose(src);
+    }
+}
+
+// the hash chains hold 16 bit positions, so the window can't have more than 65536 of them, or the
+// repetitions of the ones past that are lost
+static void check_window_end(void) {
+    static unsigned char in[2 * 32768 + 258], out[80000], back[2 * 32768 + 258];
+    uint32_t seed = 7;
+    for (size_t i = 0; i < 65536 + 129; i++) {
+        seed = seed * 1103515245 + 12345;
+        in[i] = 'a' + (seed >> 16) % 16;
+    }
+    // the end repeats the 129 bytes before it, all of them past position 65535
+    memcpy(in + 65536 + 129, in + 65536, 129);
+    for (int level = 1; level <= MAX_LEVEL; level++) {
+        size_t without_len = 0, with_len = 0;
+        struct compressor_context *c = compressor_context_new(level, MAX_WINDOW_BITS);
+        CHECK(c != NULL && compressor_context_compress(c, in, 65536 + 129, out, sizeof(out), &without_len) == 0);
+        CHECK(c != NULL && compressor_context_compress(c, in, sizeof(in), out, sizeof(out), &with_len) == 0);
+        compressor_context_free(c);
+        // the repetition is a few bytes, where the literals would be about 65
+        CHECK(with_len < without_len + 16);
+        size_t back_len = 0;
+        CHECK(deflate_decompress_buffer(out, with_len, back, sizeof(back), &back_len) == 0);
+        CHECK(back_len == sizeof(in) && memcmp(in, back, back_len) == 0);
+    }
+}
+
+// a context with a dictionary puts its hash chains back after every message, whether the message was
+// short, long enough to move the window, or in between. each one compresses like on a new context
+static void check_dictionary_messages(void) {
+    static unsigned char dict[2000], in[100000], out[2][120000];
+    static const size_t lens[] = { 500, 100000, 500, 20000, 500, 3, 100000, 20000 };
+    uint32_t seed = 3;
+    for (size_t i = 0; i < sizeof(dict); i++) {
+        seed = seed * 1103515245 + 12345;
+        dict[i] = 'a' + (seed >> 16) % 8;
+    }
+    for (size_t i = 0; i < sizeof(in); i++) {
+        seed = seed * 1103515245 + 12345;
+        in[i] = (seed >> 16) % 4 != 0 ? dict[(i * 13) % sizeof(dict)] : 'a' + (seed >> 20) % 26;
+    }
+    struct compressor_context *c = compressor_context_new(DEFAULT_LEVEL, MAX_WINDOW_BITS);
+    CHECK(c != NULL && compressor_context_set_dictionary(c, dict, sizeof(dict)) == 0);
+    for (size_t k = 0; c != NULL && k < sizeof(lens) / sizeof(lens[0]); k++) {
+        struct compressor_context *fresh = compressor_context_new(DEFAULT_LEVEL, MAX_WINDOW_BITS);
+        size_t len = 0, fresh_len = 0;
+        CHECK(fresh != NULL && compressor_context_set_dictionary(fresh, dict, sizeof(dict)) == 0);
+        CHECK(compressor_context_compress(c, in, lens[k], out[0], sizeof(out[0]), &len) == 0);
+        CHECK(fresh != NULL && compressor_context_compress(fresh, in, lens[k], out[1], sizeof(out[1]), &fresh_len) == 0);
+        CHECK(len == fresh_len && memcmp(out[0], out[1], len) == 0);
+        if (fresh != NULL) compressor_context_free(fresh);
+    }
+    if (c != NULL) compressor_context_free(c);
+}
+
+// data for the zlib vectors below: letters from 'A', each half as common as the one before, random bytes,
+// and repetitions of up to 32 bytes from up to 1000 back
+static void make_mixed(unsigned char *out, size_t len) {
+    uint32_t seed = 5;
+    size_t i = 0;
+    while (i < len) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 8;
+        if (i >= 300 && r % 16 == 0) {
+            size_t dist = 1 + (r >> 4) % 1000;
+            for (size_t n = 3 + (r >> 14) % 30; n > 0 && i < len; n--, i++) {
+                out[i] = dist <= i ? out[i - dist] : 0;
+            }
+        } else if ((r >> 4) % 8 == 0) {
+            out[i++] = r >> 7;
+        } else {
+            out[i++] = 'A' + __builtin_ctz((r >> 7) | 1 << 15);
+        }
+    }
+}
+
+// 2^k of letter k from 'a', shuffled, so the rarest letters get codes of up to 11 bits
+static size_t make_skewed(unsigned char *out) {
+    size_t len = 0;
+    for (int k = 0; k < 11; k++) {
+        memset(out + len, 'a' + k, 1 << k);
+        len += 1 << k;
+    }
+    uint32_t seed = 5;
+    for (size_t i = len - 1; i > 0; i--) {
+        seed = seed * 1103515245 + 12345;
+        size_t j = (seed >> 8) % (i + 1);
+        unsigned char swap = out[i];
+        out[i] = out[j];
+        out[j] = swap;
+    }
+    return len;
+}
+
+// raw deflate from zlib 9: make_mixed(1200) with Z_FIXED and with the default strategy, and make_skewed
+// with Z_HUFFMAN_ONLY
+static const unsigned char fixed_block[567] = {
+    0x73, 0x74, 0x72, 0x74, 0x5c, 0xe4, 0x58, 0xe0, 0xe4, 0xe8, 0x0a, 0x64, 0x38, 0x82, 0xb0, 0xa3,
+    0x33, 0x10, 0x39, 0x39, 0x3a, 0x01, 0x31, 0x90, 0xe9, 0xec, 0xe8, 0xe2, 0xb8, 0x1c, 0x24, 0xc4,
+    0xe3, 0xe2, 0xee, 0xc2, 0xee, 0xec, 0xe8, 0x04, 0x56, 0x59, 0x07, 0x54, 0x99, 0x03, 0x12, 0x05,
+    0x62, 0x57, 0x27, 0x20, 0xed, 0x06, 0x56, 0xcf, 0xee, 0x08, 0x06, 0x4e, 0x1d, 0x20, 0x29, 0x17,
+    0x10, 0xcb, 0xc9, 0x09, 0xa4, 0xc0, 0xc9, 0x09, 0x22, 0x2e, 0xe3, 0xe8, 0x06, 0x52, 0x0c, 0xe2,
+    0xf9, 0x83, 0x4c, 0x02, 0x61, 0x37, 0x67, 0x4f, 0x17, 0x67, 0x5e, 0x20, 0x03, 0x64, 0x93, 0xe3,
+    0x2d, 0xb0, 0xa0, 0x0b, 0x58, 0xd2, 0x15, 0xac, 0x07, 0x48, 0xcd, 0x07, 0xe9, 0x70, 0x72, 0x01,
+    0x5a, 0x04, 0x72, 0x0f, 0xc4, 0xac, 0xad, 0x8e, 0x20, 0x55, 0x2e, 0x40, 0x4d, 0x4e, 0x8e, 0x6c,
+    0x20, 0x75, 0x20, 0xc7, 0xb8, 0x38, 0x39, 0xfb, 0x3a, 0x81, 0xb4, 0xb7, 0x39, 0x3a, 0xea, 0x83,
+    0xac, 0x75, 0x72, 0xe4, 0x77, 0xec, 0x0d, 0x75, 0x74, 0xf3, 0x00, 0x8a, 0xb9, 0x14, 0xb8, 0x78,
+    0x82, 0x2c, 0x4f, 0x70, 0x74, 0x0a, 0x77, 0x06, 0x2a, 0x7f, 0x01, 0xf1, 0x30, 0xd0, 0xc8, 0xd0,
+    0x73, 0x0a, 0xce, 0x2e, 0xce, 0xce, 0x60, 0xfe, 0x57, 0xa0, 0x50, 0x0b, 0xc8, 0xf1, 0x40, 0x15,
+    0x6e, 0x20, 0x6f, 0x38, 0x81, 0x9d, 0x06, 0x14, 0x05, 0xb9, 0xc8, 0x09, 0xec, 0x57, 0xa7, 0x05,
+    0x40, 0x31, 0x90, 0xd3, 0x17, 0x38, 0x83, 0x9c, 0xec, 0xb2, 0xc7, 0xf1, 0x1b, 0xd8, 0x4d, 0x2e,
+    0x57, 0x1d, 0x21, 0x0a, 0xcf, 0xba, 0x78, 0x81, 0x5c, 0xec, 0x0a, 0x0a, 0x9b, 0x54, 0x90, 0x0b,
+    0x5b, 0x80, 0xa2, 0x6b, 0x1c, 0x1d, 0xd7, 0xbb, 0x80, 0x5d, 0x0f, 0xb4, 0x79, 0x09, 0x28, 0x8c,
+    0x9d, 0x0e, 0x38, 0x81, 0x43, 0xc9, 0x91, 0x01, 0x03, 0x00, 0x43, 0x13, 0x87, 0xaf, 0x1d, 0x57,
+    0x3a, 0x42, 0x3c, 0xee, 0xec, 0x06, 0x8e, 0xaa, 0x3d, 0x40, 0xf3, 0xa5, 0x21, 0xd6, 0x3a, 0x43,
+    0x83, 0x01, 0x48, 0x81, 0xcc, 0x00, 0x4b, 0x3b, 0xb9, 0x00, 0x3d, 0xc0, 0x80, 0x03, 0xa0, 0x9a,
+    0xe0, 0x0c, 0x72, 0x07, 0x0f, 0xd0, 0x18, 0xb0, 0x03, 0x70, 0xf8, 0x11, 0x12, 0x27, 0x52, 0x20,
+    0xd7, 0x83, 0x03, 0xc6, 0x15, 0x1a, 0xb7, 0xa0, 0x60, 0x01, 0xd9, 0x06, 0x8d, 0x36, 0xc7, 0x34,
+    0x47, 0xa7, 0x09, 0xa0, 0x04, 0xe4, 0x52, 0xe2, 0x08, 0x4b, 0x58, 0x40, 0x83, 0x9c, 0x54, 0x81,
+    0x2c, 0x0f, 0x27, 0x37, 0xa7, 0x15, 0x8e, 0xe0, 0xd4, 0xa5, 0xe1, 0xe1, 0xee, 0xec, 0xc8, 0x40,
+    0x2c, 0x70, 0x07, 0x07, 0x03, 0x30, 0xa2, 0x9e, 0x3b, 0x83, 0x6d, 0x72, 0x24, 0x10, 0x5e, 0x18,
+    0x4e, 0x73, 0x76, 0x01, 0x31, 0x1c, 0x2f, 0xb8, 0x38, 0xb9, 0x81, 0x02, 0xd1, 0xdd, 0xd1, 0x15,
+    0x64, 0x8a, 0xb3, 0x40, 0x64, 0x8a, 0x33, 0x44, 0xb5, 0x8b, 0x93, 0x23, 0xcc, 0xb1, 0xae, 0xe0,
+    0x10, 0x71, 0x02, 0x9b, 0x05, 0x24, 0xb5, 0xcb, 0x9c, 0xc0, 0x7e, 0x76, 0xc6, 0x1b, 0xcd, 0xae,
+    0x70, 0x6b, 0x41, 0xa9, 0xd9, 0xd9, 0x09, 0xb7, 0x03, 0x9d, 0x5c, 0x54, 0x9c, 0xc0, 0xf9, 0x4c,
+    0xd6, 0xb1, 0x1a, 0x68, 0x95, 0x4b, 0x16, 0xc4, 0x68, 0x70, 0x7a, 0x03, 0x99, 0xed, 0xf4, 0x0f,
+    0x64, 0x07, 0x28, 0x19, 0xba, 0xda, 0x39, 0x3a, 0x36, 0x82, 0x12, 0xa7, 0x0b, 0xd8, 0x52, 0x3c,
+    0x7e, 0xd6, 0x2e, 0x03, 0x25, 0x02, 0x17, 0x67, 0x70, 0x9a, 0x05, 0x09, 0x3b, 0xda, 0x3a, 0x5e,
+    0x74, 0x9a, 0xe6, 0xe8, 0xe2, 0x06, 0xf2, 0x08, 0xd0, 0x6c, 0xd4, 0x90, 0xc7, 0x65, 0xaf, 0x13,
+    0x5a, 0x98, 0xe8, 0x9e, 0x72, 0xc2, 0x97, 0x38, 0x9d, 0xc1, 0x96, 0x81, 0x0b, 0x8e, 0x28, 0xa0,
+    0x59, 0x2e, 0xae, 0x40, 0x7d, 0x5e, 0xf8, 0x83, 0x06, 0xa4, 0x25, 0x08, 0x68, 0x0a, 0xd0, 0x85,
+    0xc8, 0xa9, 0xc4, 0xd3, 0xd1, 0x89, 0x03, 0x96, 0xc2, 0x40, 0x0a, 0x81, 0xb2, 0xce, 0xce, 0x90,
+    0xf2, 0x08, 0x92, 0x53, 0x81, 0x00, 0x00,
+};
+static const unsigned char dynamic_block[495] = {
+    0x8d, 0x54, 0x3d, 0x8b, 0x14, 0x51, 0x10, 0xdc, 0xc8, 0x33, 0x38, 0xd1, 0xd8, 0x0f, 0x30, 0x50,
+    0x10, 0x0e, 0xf1, 0x17, 0x28, 0x54, 0x75, 0xcf, 0xec, 0xee, 0x81, 0x08, 0xc2, 0x71, 0x68, 0x64,
+    0xa0, 0x06, 0x62, 0x70, 0x81, 0x5c, 0x22, 0x08, 0xc2, 0x21, 0x26, 0x82, 0x91, 0xa9, 0x87, 0x08,
+    0x2a, 0x08, 0x46, 0x66, 0x17, 0x18, 0x0b, 0xca, 0x19, 0x98, 0xf8, 0x07, 0xf4, 0x0f, 0x68, 0x28,
+    0x56, 0xf5, 0xdb, 0x15, 0xcf, 0x63, 0x56, 0x1f, 0x3b, 0x3b, 0x6f, 0xfa, 0xf5, 0xab, 0xaa, 0xae,
+    0xd7, 0x33, 0x20, 0xf0, 0x0c, 0x1b, 0x44, 0xa7, 0x09, 0x7c, 0x21, 0xf4, 0x23, 0xa8, 0x4b, 0xd3,
+    0x40, 0xe2, 0x85, 0x43, 0xcb, 0x39, 0xce, 0xa5, 0x00, 0x2b, 0xf3, 0x9e, 0x32, 0x6f, 0x3b, 0xaa,
+    0xab, 0xa3, 0xee, 0x7d, 0xe5, 0x2f, 0xa1, 0x06, 0x1f, 0x7a, 0x29, 0x3d, 0x23, 0x9d, 0x40, 0xb6,
+    0xf8, 0x71, 0xf4, 0x4e, 0xf6, 0xd3, 0x25, 0x23, 0xf9, 0xea, 0x63, 0x9a, 0x71, 0x48, 0x13, 0x33,
+    0xe1, 0x4b, 0x05, 0xb3, 0x16, 0xbb, 0xda, 0xa3, 0xdb, 0x53, 0xef, 0x60, 0x8a, 0xc8, 0x7a, 0x1a,
+    0xd6, 0x5b, 0x38, 0x2b, 0xb5, 0x89, 0x38, 0xe0, 0x3c, 0x8b, 0x49, 0xc6, 0x45, 0x7a, 0xfb, 0x03,
+    0xe0, 0x9c, 0x69, 0x89, 0xc3, 0x78, 0xb4, 0x86, 0x7e, 0xa2, 0x58, 0x6e, 0xe4, 0xd4, 0xe4, 0xd7,
+    0xc0, 0xf5, 0x50, 0xfa, 0xb7, 0x56, 0xb0, 0x20, 0xd7, 0x3e, 0x9e, 0x8c, 0x8c, 0xa8, 0xe7, 0xef,
+    0x0a, 0x6d, 0x59, 0xbc, 0x32, 0x7a, 0x97, 0xc1, 0x92, 0xa6, 0xa8, 0x15, 0xb1, 0x6a, 0xe5, 0xb6,
+    0x62, 0x96, 0xbe, 0x1d, 0x96, 0x9c, 0x3b, 0xf8, 0x51, 0x9a, 0xf2, 0x33, 0x5a, 0xe2, 0x87, 0x5c,
+    0xb5, 0xe2, 0xce, 0xde, 0xdc, 0xb0, 0xc2, 0x2d, 0x45, 0x5f, 0x03, 0x6f, 0xb2, 0xd4, 0x8b, 0xf9,
+    0xb9, 0x3d, 0xe6, 0x3b, 0x96, 0x4b, 0x18, 0xed, 0x1b, 0x72, 0x73, 0xa0, 0x6a, 0xbc, 0x42, 0x2b,
+    0x3c, 0xfa, 0x3a, 0xaa, 0x1d, 0xe1, 0x1f, 0x6b, 0xb4, 0x31, 0xb3, 0x41, 0x37, 0x63, 0xd4, 0x32,
+    0x53, 0x05, 0x8c, 0x06, 0xc6, 0x5e, 0x84, 0xb0, 0x8e, 0x65, 0xc1, 0x94, 0x80, 0x81, 0x1a, 0xdb,
+    0x99, 0x1c, 0xb5, 0xfa, 0x32, 0xa6, 0x9b, 0x9d, 0xad, 0x6d, 0x31, 0xdb, 0xec, 0xd8, 0x70, 0x13,
+    0x7c, 0xec, 0x06, 0xca, 0x3b, 0x98, 0x37, 0x96, 0x80, 0x78, 0x5a, 0xb3, 0x09, 0x7b, 0xbe, 0x44,
+    0x75, 0xd7, 0x99, 0xc9, 0x38, 0x30, 0xfa, 0xdf, 0x31, 0x2e, 0x1b, 0x74, 0x50, 0x5f, 0xa3, 0x98,
+    0xf0, 0x0f, 0xbf, 0xf6, 0x49, 0x8b, 0xf4, 0x04, 0xbb, 0xc9, 0xde, 0x26, 0x8e, 0xd1, 0x19, 0x25,
+    0x8e, 0x5c, 0xb9, 0x1e, 0x2d, 0x3b, 0x89, 0xb9, 0xd8, 0xae, 0x1c, 0x61, 0x61, 0xe9, 0x7f, 0x65,
+    0x93, 0x55, 0x73, 0x2c, 0x3c, 0xe6, 0xee, 0x37, 0xad, 0xbb, 0x39, 0x38, 0x2c, 0x90, 0x79, 0x8a,
+    0xf5, 0x9e, 0x9d, 0xc0, 0x5d, 0x51, 0xe5, 0xad, 0x06, 0x5d, 0xfd, 0x66, 0x6c, 0xfe, 0x34, 0x87,
+    0xdb, 0xb0, 0xbb, 0x00, 0xdc, 0x77, 0x73, 0x66, 0x91, 0x2e, 0xa8, 0x79, 0x65, 0xd3, 0x4d, 0x90,
+    0x51, 0x3d, 0xeb, 0x30, 0xce, 0xe3, 0x13, 0x9f, 0x20, 0x7b, 0x17, 0x22, 0xec, 0xbd, 0xce, 0x0f,
+    0xf1, 0xf2, 0x2f, 0x4f, 0xce, 0xbe, 0xe7, 0xa2, 0xe6, 0x8c, 0x22, 0xab, 0x0f, 0xc7, 0x55, 0x61,
+    0x65, 0xa7, 0x7d, 0xab, 0x8b, 0xad, 0xf1, 0x96, 0xcb, 0x42, 0x91, 0xc2, 0x3f, 0xbb, 0x64, 0x0a,
+    0x1e, 0x9c, 0x77, 0x98, 0x13, 0xb5, 0x1a, 0xd1, 0xbe, 0x47, 0xed, 0x4d, 0xd5, 0xf8, 0x05,
+};
+static const unsigned char long_codes_block[531] = {
+    0x05, 0xc1, 0xc1, 0x81, 0x24, 0xc9, 0x11, 0x04, 0x31, 0x59, 0x79, 0x3b, 0x5d, 0x19, 0x6e, 0xd0,
+    0xff, 0x4f, 0x00, 0x5c, 0xe4, 0x02, 0x7f, 0x51, 0x23, 0x29, 0x0d, 0xf8, 0x3c, 0x20, 0x77, 0xb0,
+    0xca, 0x5d, 0x85, 0x12, 0x65, 0x00, 0x4e, 0x90, 0x28, 0x6d, 0xdb, 0x4e, 0x52, 0x05, 0x41, 0xdc,
+    0x74, 0xe8, 0xcd, 0x4a, 0x40, 0xcf, 0x1d, 0x91, 0x0a, 0xec, 0xec, 0xee, 0x54, 0x8e, 0xc2, 0x0c,
+    0xec, 0x00, 0x23, 0x4c, 0xde, 0x64, 0x0f, 0x98, 0x85, 0xd3, 0xce, 0x97, 0x53, 0x6f, 0xa6, 0xe5,
+    0x99, 0xa7, 0x63, 0x1e, 0x02, 0x3f, 0x9f, 0x94, 0xd7, 0x7c, 0xed, 0xaa, 0x92, 0x6a, 0xe7, 0xa6,
+    0xa0, 0x04, 0xce, 0xc2, 0x21, 0xba, 0x5b, 0x77, 0x9a, 0x89, 0x0a, 0x18, 0x8d, 0xdc, 0x70, 0xe5,
+    0xf7, 0x5f, 0x7a, 0x19, 0x4d, 0x3e, 0x47, 0x6e, 0x3e, 0xb3, 0xdb, 0x1e, 0xd5, 0x83, 0x44, 0xa3,
+    0xda, 0xd4, 0xbb, 0xed, 0x67, 0x7d, 0x94, 0x60, 0xb1, 0x45, 0x44, 0x12, 0x32, 0xe9, 0x85, 0xc4,
+    0xf0, 0xa0, 0xde, 0xfd, 0x4b, 0x5c, 0x70, 0x0b, 0x40, 0xaa, 0x5d, 0xd3, 0xa9, 0xcf, 0x1f, 0xb9,
+    0x64, 0x17, 0x73, 0x11, 0x42, 0x49, 0x0b, 0x25, 0xfd, 0xd2, 0xa0, 0x41, 0xe2, 0xf8, 0x8e, 0xd8,
+    0x68, 0xd1, 0x37, 0x6c, 0xe9, 0xd8, 0x5f, 0xd8, 0x76, 0x67, 0x8d, 0x6c, 0xcf, 0xdb, 0x60, 0xdf,
+    0xce, 0x38, 0xe8, 0x7b, 0x1d, 0x3c, 0xdf, 0xe0, 0x4a, 0x10, 0x9b, 0x71, 0xaf, 0xd4, 0x97, 0x93,
+    0x72, 0x4f, 0xac, 0x8b, 0x5d, 0xd2, 0x14, 0xfd, 0x4e, 0x4e, 0xc6, 0xa3, 0xfe, 0x46, 0x74, 0x00,
+    0xff, 0x1a, 0x39, 0xf3, 0xeb, 0xba, 0xa5, 0x55, 0xb9, 0xb3, 0xbb, 0xe5, 0x5c, 0x97, 0xa3, 0xfd,
+    0x26, 0xc2, 0xe1, 0xd6, 0xb8, 0x62, 0xda, 0x21, 0x05, 0x7f, 0xb6, 0xf9, 0x80, 0xff, 0x7d, 0xd4,
+    0x17, 0xc2, 0xda, 0xc4, 0x94, 0x54, 0x6d, 0x60, 0xac, 0x10, 0x69, 0x3f, 0x11, 0x5f, 0x69, 0xf2,
+    0x4d, 0x30, 0x12, 0xad, 0x87, 0x23, 0x96, 0xde, 0xd8, 0xbb, 0xb5, 0xa0, 0x5f, 0x30, 0x49, 0xf3,
+    0x20, 0x8a, 0x5e, 0xcd, 0x3d, 0x16, 0xe1, 0x81, 0x0a, 0x05, 0x95, 0x24, 0x00, 0x65, 0x31, 0x54,
+    0x86, 0x58, 0xf7, 0x65, 0xbd, 0xa4, 0x25, 0x66, 0xb5, 0x55, 0xcd, 0x36, 0xca, 0x3b, 0xfd, 0x03,
+    0x15, 0xd6, 0x9a, 0x63, 0x4e, 0x7e, 0x02, 0xba, 0x4a, 0xe4, 0x5a, 0x41, 0x36, 0x30, 0xd2, 0xaf,
+    0x63, 0xf3, 0x25, 0x92, 0xb0, 0x85, 0xba, 0x0e, 0xdd, 0x0b, 0xa8, 0x57, 0x93, 0x5f, 0x49, 0x64,
+    0xc5, 0xa3, 0xf7, 0x11, 0x66, 0x7d, 0x64, 0x00, 0x7b, 0x17, 0xab, 0x1d, 0xfa, 0xcd, 0x0d, 0xdc,
+    0x86, 0x25, 0x01, 0x24, 0x9b, 0x55, 0xf4, 0xfc, 0xe8, 0x3b, 0x9d, 0x77, 0x12, 0xc8, 0xda, 0x4c,
+    0x74, 0x36, 0xf5, 0x15, 0xbc, 0x22, 0xd8, 0xec, 0xd5, 0x3c, 0xd4, 0x83, 0x89, 0x01, 0xc1, 0xec,
+    0xef, 0xe9, 0x0b, 0xfb, 0x71, 0xb5, 0x28, 0x6b, 0xc6, 0x7c, 0xb0, 0xb2, 0x67, 0xb4, 0xc4, 0x44,
+    0x36, 0x37, 0xb8, 0xa3, 0xcd, 0xed, 0x61, 0x20, 0x9e, 0xcc, 0xf3, 0x47, 0xd9, 0x58, 0xd5, 0x92,
+    0x06, 0xa2, 0xd8, 0x2d, 0xb9, 0x33, 0x68, 0xdc, 0x0d, 0xce, 0x2a, 0x50, 0x64, 0xfd, 0x7d, 0x74,
+    0x52, 0x3e, 0x66, 0x78, 0x77, 0xa7, 0xa9, 0xfb, 0x16, 0x70, 0x44, 0xab, 0x1b, 0x01, 0x79, 0x0f,
+    0x81, 0x4a, 0x9a, 0x2a, 0x87, 0x57, 0x84, 0xb7, 0x68, 0xb1, 0x3d, 0x91, 0xd8, 0x6a, 0xde, 0xe5,
+    0x26, 0x32, 0xa7, 0x5b, 0x91, 0x98, 0x81, 0x3d, 0x4e, 0x1a, 0x46, 0xf9, 0xc4, 0xa6, 0x39, 0xff,
+    0xa1, 0x2f, 0xcb, 0x1b, 0x0e, 0xd0, 0x04, 0x5c, 0x58, 0x44, 0x13, 0xfb, 0x27, 0xf0, 0x6a, 0x84,
+    0xf4, 0x2e, 0x45, 0x04, 0xaa, 0x39, 0x02, 0x8a, 0xc8, 0xcf, 0x23, 0x0d, 0x66, 0x6f, 0x1e, 0xf5,
+    0x76, 0xff, 0x07,
+};
+
+// another encoder's blocks decode, through the decoding tables of fixed and dynamic codes, and the subtables
+// of codes longer than their root bits. an output buffer of exactly the data's length also makes the end
+// of the data decode on the slow path
+static void check_zlib_blocks(void) {
+    static unsigned char mixed[1200], skewed[2047], back[4096];
+    make_mixed(mixed, sizeof(mixed));
+    size_t skewed_len = make_skewed(skewed);
+    CHECK(skewed_len == sizeof(skewed));
+    const struct {
+        const unsigned char *in;
+        size_t in_len;
+        const unsigned char *data;
+        size_t len;
+    } vectors[] = {
+        { fixed_block, sizeof(fixed_block), mixed, sizeof(mixed) },
+        { dynamic_block, sizeof(dynamic_block), mixed, sizeof(mixed) },
+        { long_codes_block, sizeof(long_codes_block), skewed, sizeof(skewed) },
+    };
+    for (size_t k = 0; k < sizeof(vectors) / sizeof(vectors[0]); k++) {
+        size_t caps[] = { vectors[k].len, sizeof(back) };
+        for (int c = 0; c < 2; c++) {
+            size_t back_len = 0;
+            CHECK(deflate_decompress_buffer(vectors[k].in, vectors[k].in_len, back, caps[c], &back_len) == 0);
+            CHECK(back_len == vectors[k].len && memcmp(back, vectors[k].data, back_len) == 0);
+        }
+    }
+}
+
+// decodes in with a stream, which is given one byte of input at a time, and room for 1 to 7 bytes of output.
+// returns the stream's last result, and sets out_len to the bytes it wrote
+static int stream_steps(const unsigned char *in, size_t in_len, unsigned char *out, size_t out_cap,
+                        size_t *out_len) {
+    static struct decompressor_stream d;
+    decompressor_stream_init(&d);
+    size_t in_pos = 0, out_pos = 0;
+    int result;
+    for (size_t step = 0;; step++) {
+        size_t in_step = in_pos < in_len ? 1 : 0;
+        size_t out_step = 1 + step % 7 < out_cap - out_pos ? 1 + step % 7 : out_cap - out_pos;
+        size_t used = 0, written = 0;
+        result = decompressor_stream_run(&d, in + in_pos, in_step, &used, out + out_pos, out_step, &written);
+        in_pos += used;
+        out_pos += written;
+        // with input and room for output, a stream which didn't end always uses or writes something
+        if (result == DECOMPRESS_DONE || result > 0 || (used == 0 && written == 0)) {
+            break;
+        }
+    }
+    *out_len = out_pos;
+    return result;
+}
+
+// the stream goes on from wherever its input or output ran out, even in the middle of a header, a code or a
+// repetition. its output is moved back when its window fills, so the data is longer than two windows.
+// a sync flush ends the output so far on a byte boundary, where everything before it can be decoded
+static void check_stream_steps(void) {
+    static unsigned char in[200000], compressed[240000], back[200000], zlib_data[2047];
+    make_mixed(in, sizeof(in));
+    struct compressor_stream *c = compressor_stream_new(DEFAULT_LEVEL);
+    CHECK(c != NULL);
+    if (c == NULL) {
+        return;
+    }
+    size_t in_pos = 0, compressed_len = 0;
+    uint32_t seed = 11;
+    int result = COMPRESS_NEED_INPUT;
+    for (int piece = 0; result == COMPRESS_NEED_INPUT; piece++) {
+        seed = seed * 1103515245 + 12345;
+        size_t len = 1 + (seed >> 8) % 20000;
+        if (len > sizeof(in) - in_pos) len = sizeof(in) - in_pos;
+        int flush = in_pos + len == sizeof(in) ? COMPRESS_FINISH : piece % 3 == 2 ? COMPRESS_SYNC_FLUSH : COMPRESS_NO_FLUSH;
+        size_t used = 0, written = 0;
+        result = compressor_stream_run(c, in + in_pos, len, &used, compressed + compressed_len,
+                                       sizeof(compressed) - compressed_len, &written, flush);
+        in_pos += used;
+        compressed_len += written;
+        if (flush == COMPRESS_SYNC_FLUSH && result == COMPRESS_NEED_INPUT) {
+            size_t back_len = 0;
+            CHECK(stream_steps(compressed, compressed_len, back, sizeof(back), &back_len) == DECOMPRESS_NEED_INPUT);
+            CHECK(back_len == in_pos && memcmp(back, in, back_len) == 0);
+        }
+    }
+    compressor_stream_free(c);
+    CHECK(result == COMPRESS_DONE && in_pos == sizeof(in));
+    size_t back_len = 0;
+    CHECK(stream_steps(compressed, compressed_len, back, sizeof(back), &back_len) == DECOMPRESS_DONE);
+    CHECK(back_len == sizeof(in) && memcmp(back, in, back_len) == 0);
+
+    // zlib's dynamic blocks, a code at a time
+    make_mixed(zlib_data, 1200);
+    CHECK(stream_steps(dynamic_block, sizeof(dynamic_block), back, sizeof(back), &back_len) == DECOMPRESS_DONE);
+    CHECK(back_len == 1200 && memcmp(back, zlib_data, back_len) == 0);
+    make_skewed(zlib_data);
+    CHECK(stream_steps(long_codes_block, sizeof(long_codes_block), back, sizeof(back), &back_len) == DECOMPRESS_DONE);
+    CHECK(back_len == sizeof(zlib_data) && memcmp(back, zlib_data, back_len) == 0);
+}
+
+// parallel chunks are joined into one stream, which is the same on any number of threads. the lengths are
+// none, one byte, exactly two 128K chunks, and a last chunk which is short, at a greedy and a lazy level
+static void check_parallel(void) {
+    static unsigned char in[600000], out[2][700000], back[600000];
+    static const size_t lens[] = { 0, 1, 2 * 131072, sizeof(in) };
+    static const int levels[] = { 1, DEFAULT_LEVEL };
+    make_mixed(in, sizeof(in));
+    for (size_t k = 0; k < sizeof(lens) / sizeof(lens[0]); k++) {
+        for (int l = 0; l < 2; l++) {
+            size_t out_len[2] = { 0, 0 }, back_len = 0;
+            CHECK(deflate_compress_parallel(in, lens[k], out[0], sizeof(out[0]), &out_len[0], levels[l], 1) == 0);
+            CHECK(deflate_compress_parallel(in, lens[k], out[1], sizeof(out[1]), &out_len[1], levels[l], 4) == 0);
+            CHECK(out_len[0] == out_len[1] && memcmp(out[0], out[1], out_len[0]) == 0);
+            CHECK(deflate_decompress_buffer(out[1], out_len[1], back, sizeof(back), &back_len) == 0);
+            CHECK(back_len == lens[k] && memcmp(back, in, back_len) == 0);
+        }
+    }
+}
+
+// any range decompressed from the nearest seek point is the same as that part of the whole output,
+// whether it starts at a seek point, crosses some, or runs past the end
+static void check_index_ranges(void) {
+    static unsigned char in[300000], compressed[340000], range[100000];
+    make_mixed(in, sizeof(in));
+    size_t compressed_len = 0;
+    CHECK(deflate_compress_buffer(in, sizeof(in), compressed, sizeof(compressed), &compressed_len) == 0);
+    struct deflate_index *index = NULL;
+    CHECK(deflate_index_build(compressed, compressed_len, 20000, &index) == 0);
+    if (index == NULL) {
+        return;
+    }
+    CHECK(index->out_len == sizeof(in) && index->points > 5);
+    size_t offsets[40], lens[40];
+    offsets[0] = 0;
+    lens[0] = 1;
+    offsets[1] = index->point[index->points - 1].out_offset;
+    lens[1] = 1000;
+    offsets[2] = sizeof(in) - 10;
+    lens[2] = 100;
+    offsets[3] = sizeof(in);
+    lens[3] = 10;
+    uint32_t seed = 13;
+    for (int k = 4; k < 40; k++) {
+        seed = seed * 1103515245 + 12345;
+        offsets[k] = (seed >> 8) % sizeof(in);
+        seed = seed * 1103515245 + 12345;
+        lens[k] = 1 + (seed >> 8) % sizeof(range);
+    }
+    for (int k = 0; k < 40; k++) {
+        size_t out_len = SIZE_MAX;
+        size_t expected = sizeof(in) - offsets[k] < lens[k] ? sizeof(in) - offsets[k] : lens[k];
+        CHECK(deflate_decompress_range(index, compressed, compressed_len, offsets[k], range, lens[k], &out_len) == 0);
+        CHECK(out_len == expected && memcmp(range, in + offsets[k], out_len) == 0);
+    }
+    deflate_index_free(index);
+}
+
+// from Python's zlib at level 9: bytes 400 to 1200 of make_mixed(1200) as zlib data with the first 800 as
+// its dictionary, and as a gzip file with a time of 0
+static const unsigned char zlib_dict_stream[166] = {
+    0x78, 0xf9, 0x9d, 0x38, 0xc4, 0xf9, 0x1b, 0x8d, 0x8f, 0xc1, 0x15, 0x1f, 0x60, 0xb3, 0x80, 0xa4,
+    0x76, 0x99, 0x13, 0xd8, 0xcf, 0xce, 0x78, 0xb3, 0x9d, 0x2b, 0xdc, 0x5a, 0x50, 0xe9, 0xe2, 0xec,
+    0x84, 0xdb, 0x81, 0x4e, 0x2e, 0x2a, 0x4e, 0xe0, 0x72, 0x4f, 0xd6, 0xb1, 0x1a, 0x68, 0x95, 0x4b,
+    0x16, 0xc4, 0x68, 0x70, 0xfe, 0x07, 0x99, 0xed, 0xf4, 0x0f, 0x64, 0x07, 0xa8, 0x58, 0x70, 0xb5,
+    0x73, 0x74, 0x6c, 0x04, 0x15, 0x16, 0x2e, 0x60, 0x4b, 0xf1, 0xf8, 0x59, 0xbb, 0x0c, 0x94, 0x08,
+    0x5c, 0x9c, 0xc1, 0x65, 0x08, 0x48, 0xd8, 0xd1, 0xd6, 0xf1, 0xa2, 0xd3, 0x34, 0x47, 0x17, 0x37,
+    0x90, 0x47, 0x80, 0x66, 0xa3, 0x86, 0x3c, 0x2e, 0x7b, 0x9d, 0xd0, 0xc2, 0x44, 0xf7, 0x94, 0x13,
+    0xbe, 0xc2, 0xc2, 0x19, 0x6c, 0x19, 0xb8, 0x20, 0x8f, 0x02, 0x9a, 0xe5, 0xe2, 0x0a, 0xd4, 0xe7,
+    0x85, 0x3f, 0x68, 0x40, 0x5a, 0x82, 0x80, 0xa6, 0x00, 0x5d, 0x88, 0x9c, 0x4a, 0x3c, 0x1d, 0x9d,
+    0x38, 0x60, 0x29, 0x0c, 0xa4, 0x10, 0x28, 0xeb, 0xec, 0x0c, 0xa9, 0x1f, 0x20, 0x25, 0x27, 0x10,
+    0x00, 0x00, 0x73, 0xe4, 0xbc, 0x2d,
+};
+static const unsigned char gzip_file[342] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x8d, 0x52, 0xb1, 0x4e, 0xc3, 0x50,
+    0x0c, 0xcc, 0xc8, 0xc0, 0xc0, 0x0c, 0x62, 0x03, 0x09, 0xa9, 0xe2, 0x13, 0x40, 0xba, 0xb3, 0x5f,
+    0x5a, 0x3a, 0xb2, 0xc1, 0x0c, 0x0c, 0xcc, 0x55, 0x17, 0x26, 0x24, 0x3e, 0x80, 0x89, 0x95, 0x8e,
+    0xf0, 0x01, 0x6c, 0xfd, 0x02, 0x24, 0x24, 0x18, 0x58, 0xf8, 0x01, 0xfe, 0x80, 0x11, 0x71, 0x76,
+    0x28, 0x6a, 0x0a, 0xa9, 0x70, 0x93, 0xe6, 0xc5, 0xb1, 0xef, 0xce, 0x27, 0x57, 0x55, 0x06, 0x8d,
+    0xb7, 0x20, 0x40, 0x2f, 0x34, 0x83, 0xc5, 0x59, 0xf1, 0xa0, 0xe7, 0x3d, 0x5c, 0x69, 0xe5, 0x6a,
+    0x28, 0x8f, 0x29, 0x9c, 0x1b, 0x2a, 0xd4, 0x4f, 0x6f, 0xb4, 0xac, 0x63, 0x60, 0xe4, 0x67, 0x3a,
+    0xc9, 0xaa, 0x23, 0xda, 0x08, 0x06, 0xa5, 0x56, 0x05, 0x93, 0x02, 0x26, 0x14, 0x24, 0x51, 0x4f,
+    0xcc, 0x81, 0x37, 0x9f, 0xe2, 0x03, 0xb3, 0x20, 0xd6, 0x61, 0x82, 0x0d, 0xc6, 0x42, 0x7e, 0x67,
+    0xeb, 0x94, 0x0b, 0x94, 0x7c, 0x3b, 0x03, 0xaf, 0x95, 0x30, 0x1f, 0xa5, 0xf4, 0xb8, 0x05, 0xc4,
+    0x6d, 0x9d, 0x06, 0xac, 0x79, 0x17, 0x19, 0xc3, 0xce, 0xa0, 0x9f, 0xac, 0xff, 0x8b, 0x7e, 0xda,
+    0x60, 0xc6, 0x77, 0x4b, 0xa6, 0xb9, 0xce, 0x3f, 0xfd, 0xfa, 0x25, 0xcd, 0x3c, 0x0e, 0x78, 0x76,
+    0xd6, 0x61, 0x62, 0x1f, 0x25, 0x50, 0x6c, 0xed, 0xe8, 0xc4, 0x9a, 0x6a, 0x27, 0x66, 0x62, 0x4b,
+    0x3a, 0xc2, 0xc4, 0xd2, 0x7f, 0x6f, 0xcc, 0x9c, 0x59, 0x85, 0xfe, 0x8a, 0xc6, 0xef, 0x27, 0x1f,
+    0x06, 0x5e, 0x91, 0x09, 0x76, 0x1a, 0xbd, 0x57, 0xe5, 0x87, 0xd6, 0x44, 0x60, 0xec, 0x16, 0x48,
+    0xdf, 0x8a, 0x59, 0x88, 0x4d, 0x5c, 0x88, 0xca, 0xcf, 0x1b, 0xe8, 0xe8, 0x0e, 0xe3, 0xc1, 0xcf,
+    0xe0, 0x90, 0x48, 0x2b, 0xfb, 0xc0, 0xa5, 0x85, 0xb8, 0x24, 0x5d, 0x32, 0x73, 0x6f, 0x1c, 0x4b,
+    0xe0, 0x21, 0xb8, 0x49, 0x63, 0x0f, 0x2f, 0xbc, 0x81, 0xd7, 0x31, 0x88, 0xb0, 0xdb, 0xce, 0x77,
+    0xf1, 0x72, 0xc1, 0x93, 0xdd, 0xc7, 0x85, 0x05, 0x6a, 0x13, 0x5b, 0x92, 0x85, 0x6f, 0x76, 0x2c,
+    0x2c, 0x2f, 0xea, 0x1b, 0x2e, 0xb7, 0x26, 0x5a, 0x0e, 0x85, 0x22, 0x85, 0xf3, 0x5b, 0x72, 0x00,
+    0xae, 0xcc, 0x36, 0x2c, 0x0a, 0xf5, 0x55, 0x73, 0xa1, 0xb9, 0x72, 0xbd, 0x81, 0x2f, 0xb6, 0xf8,
+    0x1d, 0xba, 0x20, 0x03, 0x00, 0x00,
+};
+
+// zlib and gzip data from zlib decompress, with the dictionary its FDICT names and not with another one,
+// and what's compressed here names the dictionary like zlib does, with the same checksums in the trailers
+static void check_zlib_containers(void) {
+    static unsigned char mixed[1200], other[800];
+    make_mixed(mixed, sizeof(mixed));
+    const unsigned char *dict = mixed, *data = mixed + 400;
+    size_t dict_len = 800, len = 800;
+    memcpy(other, dict, dict_len);
+    other[0] ^= 1;
+    struct deflate_memory out = { NULL, 0, 0 };
+    CHECK(decompress_file(zlib_dict_stream, sizeof(zlib_dict_stream), FORMAT_ZLIB, dict, dict_len, &out) == 0);
+    CHECK(out.len == len && memcmp(out.data, data, len) == 0);
+    free(out.data);
+    out = (struct deflate_memory){ NULL, 0, 0 };
+    CHECK(decompress_file(zlib_dict_stream, sizeof(zlib_dict_stream), FORMAT_ZLIB, NULL, 0, &out) == ERR_DICTIONARY);
+    free(out.data);
+    out = (struct deflate_memory){ NULL, 0, 0 };
+    CHECK(decompress_file(zlib_dict_stream, sizeof(zlib_dict_stream), FORMAT_ZLIB, other, dict_len, &out) ==
+          ERR_DICTIONARY);
+    free(out.data);
+    out = (struct deflate_memory){ NULL, 0, 0 };
+    CHECK(gunzip(gzip_file, sizeof(gzip_file), &out) == 0 && out.len == len && memcmp(out.data, data, len) == 0);
+    free(out.data);
+
+    for (int format = FORMAT_ZLIB; format <= FORMAT_GZIP; format++) {
+        FILE *file = file_of(data, len);
+        CHECK(file != NULL);
+        if (file == NULL) {
+            continue;
+        }
+        struct deflate_memory compressed = { NULL, 0, 0 };
+        struct deflate_sink sink = deflate_sink_memory(&compressed);
+        CHECK(compressor_sink_dict(&sink, file, DEFAULT_LEVEL, format, dict, dict_len) == 0);
+        fclose(file);
+        const unsigned char *c = compressed.data;
+        if (format == FORMAT_ZLIB) {
+            // FDICT, and the dictionary's adler32 where zlib puts it
+            CHECK(compressed.len > 10 && c[0] == 0x78 && (c[0] << 8 | c[1]) % 31 == 0 && (c[1] & 0x20) != 0);
+            CHECK(compressed.len > 10 && memcmp(c + 2, zlib_dict_stream + 2, 4) == 0);
+            CHECK(compressed.len > 10 &&
+                  memcmp(c + compressed.len - 4, zlib_dict_stream + sizeof(zlib_dict_stream) - 4, 4) == 0);
+        } else {
+            // the crc32 and length are the same as zlib's, and the header has no dictionary
+            CHECK(compressed.len > 18 && c[0] == 0x1f && c[1] == 0x8b && c[2] == 8);
+            CHECK(compressed.len > 18 && memcmp(c + compressed.len - 8, gzip_file + sizeof(gzip_file) - 8, 8) == 0);
+        }
+        out = (struct deflate_memory){ NULL, 0, 0 };
+        CHECK(decompress_file(c, compressed.len, format, format == FORMAT_ZLIB ? dict : NULL,
+                              format == FORMAT_ZLIB ? dict_len : 0, &out) == 0);
+        CHECK(out.len == len && memcmp(out.data, data, len) == 0);
+        free(out.data);
+        free(compressed.data);
+    }
+}
+
+// every level round trips, over data with repetitions, data which doesn't compress, and long runs.
+// level 0 is taken as 1
+static void check_levels(void) {
+    static unsigned char in[150000], out[170000], back[150000];
+    make_mixed(in, 100000);
+    uint32_t seed = 17;
+    for (size_t i = 100000; i < 130000; i++) {
+        seed = seed * 1103515245 + 12345;
+        in[i] = seed >> 24;
+    }
+    memset(in + 130000, 'z', 20000);
+    for (int level = 0; level <= MAX_LEVEL; level++) {
+        struct compressor_context *c = compressor_context_new(level, MAX_WINDOW_BITS);
+        size_t out_len = 0, back_len = 0;
+        CHECK(c != NULL && compressor_context_compress(c, in, sizeof(in), out, sizeof(out), &out_len) == 0);
+        CHECK(deflate_decompress_buffer(out, out_len, back, sizeof(back), &back_len) == 0);
+        CHECK(back_len == sizeof(in) && memcmp(back, in, back_len) == 0);
+        if (c != NULL) compressor_context_free(c);
+    }
+}
+
+int main(void) {
+    check_small_dictionary();
+    check_greedy_runs();
+    check_small_stack();
+    check_batch_position();
+    check_gzip_members();
+    check_read_error();
+    check_window_end();
+    check_dictionary_messages();
+    check_zlib_blocks();
+    check_stream_steps();
+    check_parallel();
+    check_index_ranges();
+    check_zlib_containers();
+    check_levels();
+    if (failed == 0) {
+        printf("all checks passed\n");
+    }
+    return failed;
+}
@@ -0,0 +1,185 @@
+#include "deflate.h"
+
+#define CRC32_POLY 0xedb88320 // reversed, because bits go least significant first
+#define ADLER_MOD  65521      // the biggest prime below 65536
+#define ADLER_NMAX 5552       // the most bytes before the adler-32 sums can overflow 32 bits
+
+// crc_table[0] is the usual byte at a time table. crc_table[k] is the crc of a byte followed by k zero bytes,
+// so 8 bytes can be looked up independently and combined
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void make_crc_table(void) {
+    for (int n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        crc_table[0][n] = c;
+    }
+    for (int n = 0; n < 256; n++) {
+        for (int k = 1; k < 8; k++) {
+            crc_table[k][n] = (crc_table[k - 1][n] >> 8) ^ crc_table[0][crc_table[k - 1][n] & 0xff];
+        }
+    }
+}
+
+// slice-by-8, on the inverted crc
+static uint32_t crc32_tables(uint32_t crc, const unsigned char *p, size_t len) {
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word = le64toh(word) ^ crc;
+        crc = crc_table[7][word & 0xff] ^ crc_table[6][(word >> 8) & 0xff] ^
+              crc_table[5][(word >> 16) & 0xff] ^ crc_table[4][(word >> 24) & 0xff] ^
+              crc_table[3][(word >> 32) & 0xff] ^ crc_table[2][(word >> 40) & 0xff] ^
+              crc_table[1][(word >> 48) & 0xff] ^ crc_table[0][word >> 56];
+    }
+    for (; len > 0; len--, p++) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p) & 0xff];
+    }
+    return crc;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <wmmintrin.h>
+#define HAVE_CRC32_CLMUL
+
+// Folds 64 bytes at a time with carry-less multiplication, then reduces to 32 bits with a Barrett reduction,
+// on the inverted crc. len must be a multiple of 16, and at least 64.
+// The constants are powers of x modulo the polynomial, from Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction"
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_clmul(uint32_t crc, const unsigned char *p, size_t len) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    p += 64;
+    len -= 64;
+
+    // fold 4 lanes of 128 bits over the next 64 bytes
+    while (len >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(p + 0x30)));
+        p += 64;
+        len -= 64;
+    }
+
+    // fold the 4 lanes into one, then the rest of the input 16 bytes at a time
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+    for (; len >= 16; len -= 16, p += 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11),
+                                         _mm_loadu_si128((const __m128i *)p)), x5);
+    }
+
+    // 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+static bool has_clmul = false;
+
+static void checksum_init(void) {
+    make_crc_table();
+#ifdef HAVE_CRC32_CLMUL
+    __builtin_cpu_init();
+    has_clmul = __builtin_cpu_supports("pclmul");
+#endif
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = data;
+    pthread_once(&crc_table_once, checksum_init);
+    crc = ~crc;
+#ifdef HAVE_CRC32_CLMUL
+    if (has_clmul && len >= 64) {
+        size_t span = len & ~(size_t)15;
+        crc = crc32_clmul(crc, p, span);
+        p += span;
+        len -= span;
+    }
+#endif
+    return ~crc32_tables(crc, p, len);
+}
+
+uint32_t adler32_update(uint32_t adler, const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    while (len > 0) {
+        size_t span = len < ADLER_NMAX ? len : ADLER_NMAX;
+        len -= span;
+#ifdef __SSE2__
+        // every 16 bytes add their sum to s1, and to s2 their sum weighted by how many bytes are left
+        // until the end of the 16, plus 16 times s1 from before them
+        if (span >= 16) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i weights_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+            const __m128i weights_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+            __m128i v1 = zero;       // byte sums
+            __m128i v1_before = zero; // sums of v1 before each 16 bytes
+            __m128i v2 = zero;       // weighted sums
+            size_t chunks = span / 16;
+            for (size_t k = 0; k < chunks; k++, p += 16) {
+                __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+                v1_before = _mm_add_epi32(v1_before, v1);
+                v1 = _mm_add_epi32(v1, _mm_sad_epu8(bytes, zero));
+                v2 = _mm_add_epi32(v2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weights_lo));
+                v2 = _mm_add_epi32(v2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weights_hi));
+            }
+            uint32_t lanes[4];
+            _mm_storeu_si128((__m128i *)lanes, v1_before);
+            uint64_t sum2 = 16 * ((uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3]) + (uint64_t)s1 * 16 * chunks;
+            _mm_storeu_si128((__m128i *)lanes, v2);
+            sum2 += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            _mm_storeu_si128((__m128i *)lanes, v1);
+            s1 += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            s2 = (s2 + sum2) % ADLER_MOD;
+            span -= chunks * 16;
+        }
+#endif
+        for (; span > 0; span--, p++) {
+            s1 += *p;
+            s2 += s1;
+        }
+        s1 %= ADLER_MOD;
+        s2 %= ADLER_MOD;
+    }
+    return (s2 << 16) | s1;
+}
@@ -0,0 +1,14 @@
+#ifndef GUARD_d4edfd30_791c_40d1_8ac1_888f03d07c15
+#define GUARD_d4edfd30_791c_40d1_8ac1_888f03d07c15
+#include "deflate.h"
+// Checksums of the zlib and gzip containers
+// Both are updated span by span, starting from the initial value
+#define CRC32_INIT   0
+#define ADLER32_INIT 1
+
+// CRC-32 of gzip, with PCLMULQDQ folding when the CPU has it, otherwise 8 bytes at a time with tables
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+// Adler-32 of zlib, 16 bytes at a time with SSE2
+uint32_t adler32_update(uint32_t adler, const void *data, size_t len);
+#endif
@@ -1,111 +1,357 @@
 #include "compressor.h"
 #include "huffman.h"
 
+#define WINDOW_SIZE (1 << MAX_WINDOW_BITS) // how far back a repetition can reach, with the biggest window
+#define MAX_REPEAT  258   // the longest repetition deflate can encode
+#define BLOCK_SIZE  WINDOW_SIZE // the most positions in a block, with the biggest window
+#define SPLIT_SIZE  4096  // a block can end every this many positions
+#define SKIP_CHUNKS 7     // chunks taken as literals after one which didn't compress, see compress_range
+#define SKIP_SAMPLE 16    // a chunk taken as literals still looks for repetitions every this many positions
+// bits of the hash heads and of the most positions in a block. a small window still gets SPLIT_SIZE of
+// each, so its blocks and hash chains aren't much shorter than they need to be
+#define TABLE_BITS(window_bits) ((window_bits) < 12 ? 12 : (window_bits))
+#define TABLE_ENTRIES(window_bits) ((3 << TABLE_BITS(window_bits)) + (1 << (window_bits))) // see init_matcher
+#define NO_POSITION 0     // end of a hash chain. window position 0 is never matched against
+#define STREAM_WINDOW (2 * WINDOW_SIZE) // window of a stream, see compress_buffer
+
+// How hard to look for repetitions at each level
+struct level_config {
+    bool lazy;       // whether to check if the next position has a longer repetition before taking one
+    int good_length; // lazy: if the repetition is at least this long, search the next position less
+    int lazy_length; // lazy: if the repetition is at least this long, take it without checking the next position
+                     // greedy: don't add positions inside repetitions longer than this to the hash chains
+    int nice_length; // a repetition at least this long is good enough, and stops the search
+    int max_chain;   // how many positions with the same hash are checked for a repetition
+    int passes;      // optimal: how many times the parse runs, each with the costs of the one before, or 0
+};
+
+static const struct level_config level_configs[MAX_LEVEL + 1] = {
+    // lazy good lazy nice chain passes
+    { false,   0,   0,   0,    0, 0 }, // 0: unused
+    { false,   4,   4,   8,    1, 0 }, // 1: a single probe per position
+    { false,   4,   5,  16,    8, 0 }, // 2
+    { false,   4,   6,  32,   32, 0 }, // 3
+    { true,    4,   4,  16,   16, 0 }, // 4
+    { true,    8,  16,  32,   32, 0 }, // 5
+    { true,    8,  16, 128,  128, 0 }, // 6
+    { true,    8,  32, 128,  256, 0 }, // 7
+    { true,   32, 128, 258, 1024, 0 }, // 8
+    { true,   32, 258, 258, 4096, 0 }, // 9
+    { false,   0,   0, 258,  256, 2 }, // 10: optimal parse
+    { false,   0,   0, 258, 1024, 4 }, // 11
+    { false,   0,   0, 258, 4096, 8 }, // 12
+};
+
+#define MAX_CANDIDATES 8 // optimal: repetitions kept for every position
+
+// optimal: the repetitions of a position which are longer than all the nearer ones, nearest first.
+// a length between two of them is written with the distance of the longer one
+struct candidates {
+    int count;
+    uint16_t len[MAX_CANDIDATES];
+    uint16_t dist[MAX_CANDIDATES];
+};
+
+struct optimal_chunk;
+
 struct state {
-    FILE *dest;
-    FILE *src;
-    bool eof;                    // whether file ended
-    bool dry;                    // don't actually write this, only store how many bits it would be. not implemented yet.
-    int bit_buf;                 // bit buffer to be written
+    bool dry;                    // don't actually write this, only count the bytes in out_len
+    uint64_t bit_buf;            // bit buffer to be written
     int bit_count;               // number of bits in bit buffer
-    int in_buf_index;            // index in in_buf
-    unsigned char in_buf[65536]; // used for repetitions
-    int repetition_len[65536];   // length of best repetition, otherwise 0
-    int repetition_dist[65536];  // distance of best repetition, otherwise 0
-    int karp_rabin_3[65536];     // an identifying number for each 3-character repetition
+    unsigned char *out;          // output buffer
+    size_t out_len;              // number of bytes written to out
+    size_t out_cap;              // size of out
+    unsigned char *in_buf;       // input given to a stream
+    const unsigned char *window; // in_buf, or the input buffer. used for repetitions
+    int in_buf_index;            // number of bytes in window
+    int block_start;             // window position of the first entry in repetition_len and repetition_dist
+    const struct level_config *config; // how hard to look for repetitions
+    int insert_index;            // window positions before this are in the hash chains
+    int window_size;             // how far back a repetition can reach
+    int block_size;              // the most positions in a block
+    int hash_bits;               // bits of a hash
+    uint16_t *head;              // the latest window position for every hash of 3 characters
+    uint16_t *prev;              // the previous window position with the same hash, for the last window_size positions
+    uint16_t *repetition_len;    // length of best repetition, otherwise 0. block_size entries, one per block position
+    uint16_t *repetition_dist;   // distance of best repetition, otherwise 0
+    int skip_chunks;             // chunks left which aren't searched for repetitions, because the data doesn't compress
+    struct optimal_chunk *optimal; // optimal: what the parse of a chunk needs, allocated for the first one. see free_matcher
+#ifdef DEFLATE_STATS
+    struct deflate_stats *stats; // counts what the compressor does, or NULL
+#endif
     jmp_buf except;
 };
 
+static void write_byte(unsigned char byte, struct state *s) {
+    if (s->dry) {
+        s->out_len += 1;
+        return;
+    }
+    if (s->out_len == s->out_cap) {
+        longjmp(s->except, ERR_OUTPUT_TOO_SMALL);
+    }
+    s->out[s->out_len++] = byte;
+}
+
 static void write_bits(int bits, int count, struct state *s) {
-    unsigned long bit_buf = s->bit_buf;
-    bit_buf = bit_buf | (bits << s->bit_count);
+    s->bit_buf |= (uint64_t)bits << s->bit_count;
     s->bit_count += count;
     while (s->bit_count >= 8) {
         // write a byte
-        unsigned char byte = bit_buf;
-        fwrite(&byte, 1, 1, s->dest);
-        bit_buf >>= 8;
+        write_byte(s->bit_buf, s);
+        s->bit_buf >>= 8;
         s->bit_count -= 8;
     }
-
-    s->bit_buf = (int)(bit_buf);
 }
 
 static void flush_bits(struct state *s) {
     while (s->bit_count >= 8) {
-        unsigned char byte = s->bit_buf;
-        fwrite(&byte, 1, 1, s->dest);
+        write_byte(s->bit_buf, s);
         s->bit_buf >>= 8;
         s->bit_count -= 8;
     };
     // write remaining bits, which do not align to a byte, with 0s after them
     if (s->bit_count > 0) {
-        unsigned char byte = s->bit_buf << (8 - s->bit_count);
-        fwrite(&byte, 1, 1, s->dest);
+        write_byte(s->bit_buf, s);
+        s->bit_buf = 0;
+        s->bit_count = 0;
     }
 }
 
-// Reads a byte, saves it to in_buf and calculates karp_rabin_3
-static unsigned char read_byte(struct state *s) {
-    unsigned char byte;
-    if (fread(&byte, 1, 1, s->src) != 1) {
-        // file is done
-        s->eof = true;
-        return 0;
+// an identifying number for the 3 characters at p
+static inline int karp_rabin_3(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static inline int hash_3(const unsigned char *p, int bits) {
+    return (uint32_t)(karp_rabin_3(p) * 0x9e3779b1u) >> (32 - bits);
+}
+
+#define HASH_BATCH 64 // positions hashed at a time, before they are added to the hash chains
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2
+
+// hashes count positions from p like hash_3, 8 at a time: each half of a register gets 16 bytes, from p
+// and from p + 4, and a shuffle spreads them into the 3 characters of 4 positions each.
+// reads up to count + 12 bytes from p
+__attribute__((target("avx2")))
+static int hash_batch_avx2(const unsigned char *p, int count, int bits, uint16_t *hashes) {
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 1, 2, 3, -1, 2, 3, 4, -1, 3, 4, 5, -1,
+                                            0, 1, 2, -1, 1, 2, 3, -1, 2, 3, 4, -1, 3, 4, 5, -1);
+    const __m256i multiplier = _mm256_set1_epi32(0x9e3779b1u);
+    const __m128i shift = _mm_cvtsi32_si128(32 - bits);
+    int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m128i low = _mm_loadu_si128((const __m128i *)(p + k));
+        __m128i high = _mm_loadu_si128((const __m128i *)(p + k + 4));
+        __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+        __m256i h = _mm256_srl_epi32(_mm256_mullo_epi32(_mm256_shuffle_epi8(bytes, spread), multiplier), shift);
+        // the hashes are less than 16 bits, so packing them doesn't saturate. the pack works within each half
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(h, h), 0x08);
+        _mm_storeu_si128((__m128i *)(hashes + k), _mm256_castsi256_si128(packed));
     }
-    int i = s->in_buf_index++;
-    s->in_buf[i] = byte;
-    if (i >= 2) {
-        // calculate karp-rabin for 3 characters
-        s->karp_rabin_3[i - 2] =
-            ((s->in_buf[i - 2])) |
-            ((s->in_buf[i - 1]) << 8) |
-            ((s->in_buf[i - 0]) << 16);
-    }
-    if (i == 65535) {
-        // move everything 32768 bytes
-        memmove(s->in_buf, s->in_buf + 32768, 32768);
-        memmove(s->repetition_len, s->repetition_len + 32768, 32768);
-        memmove(s->repetition_dist, s->repetition_dist + 32768, 32768);
-        memmove(s->karp_rabin_3, s->karp_rabin_3 + 32768, 32768);
-        s->in_buf_index = 32768;
-    }
-    return byte;
-}
-
-// iterates from s->in_buf_index - i to s->in_buf_index - j, and finds the best repetitions
-static void find_repetitions(int i, int j, struct state *s) {
-    i = s->in_buf_index - i;
-    j = s->in_buf_index - j;
-    for (; i < j; i++) {
-        // go over the last 32768 bytes in the buffer, and look for a karp-rabin equality
-        int r = i - 32768;
-        if (r < 0) r = 0;
-        int r_max = s->in_buf_index - 2; // there is no karp-rabin after r_max
-        if (r_max >= i) r_max = i;       // don't repeat with yourself
-
-        int best_repetition_r = 0;
-        int best_repetition_length = 0;
-        for (; r < r_max; r++) {
-            // look for a repetition
-            if (s->karp_rabin_3[r] == s->karp_rabin_3[i]) {
-                // found a 3-character or more repetition! check for real length
-                int repeat_len = 3;
-                while (s->in_buf[r + repeat_len] == s->in_buf[i + repeat_len]) {
-                    repeat_len++;
-                }
-                if (repeat_len >= best_repetition_length) { // we always prefer the later repetition because it's less bits
-                    best_repetition_r = r;
-                    best_repetition_length = repeat_len;
-                }
+    return k;
+}
+#endif
+
+static bool has_avx2 = false;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+static void cpu_init(void) {
+#ifdef HAVE_AVX2
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+// adds window positions up to j to the hash chains
+// the hashes of a batch of positions are found first, since they don't depend on each other
+static void insert_hashes(int j, struct state *s) {
+    // a hash needs 3 characters
+    if (j > s->in_buf_index - 2) j = s->in_buf_index - 2;
+    uint16_t hashes[HASH_BATCH];
+    for (int i = s->insert_index; i < j; i += HASH_BATCH) {
+        int count = j - i < HASH_BATCH ? j - i : HASH_BATCH;
+        int k = 0;
+#ifdef HAVE_AVX2
+        if (has_avx2 && i + count + 12 <= s->in_buf_index) {
+            k = hash_batch_avx2(s->window + i, count, s->hash_bits, hashes);
+        }
+#endif
+        for (; k < count; k++) {
+            hashes[k] = hash_3(s->window + i + k, s->hash_bits);
+        }
+        for (k = 0; k < count; k++) {
+            s->prev[(i + k) & (s->window_size - 1)] = s->head[hashes[k]];
+            s->head[hashes[k]] = i + k;
+        }
+    }
+    if (j > s->insert_index) s->insert_index = j;
+}
+
+// moves the hash chains back by window_size, after the window moved forward.
+// positions which fall out of the window end their chains
+static void slide_hashes(struct state *s) {
+    int size = s->window_size;
+    for (int h = 0; h < 1 << s->hash_bits; h++) {
+        s->head[h] = s->head[h] >= size ? s->head[h] - size : NO_POSITION;
+    }
+    for (int i = 0; i < size; i++) {
+        s->prev[i] = s->prev[i] >= size ? s->prev[i] - size : NO_POSITION;
+    }
+    s->insert_index -= size;
+}
+
+// clears the hash chains of the input at window, for the next input. the heads of a small input are
+// cleared one by one, which is a lot less than the whole table, and prev is never cleared, because
+// a chain only reaches the positions which were added after its head was cleared
+static void clear_hashes(const unsigned char *window, struct state *s) {
+    int hash_size = 1 << s->hash_bits;
+    if (s->window != window || s->insert_index > hash_size / 4) {
+        // the window moved, so the chains have positions which aren't in it anymore
+        memset(s->head, 0, hash_size * sizeof(uint16_t));
+    } else {
+        int end = s->insert_index < s->in_buf_index - 2 ? s->insert_index : s->in_buf_index - 2;
+        for (int i = 0; i < end; i++) {
+            s->head[hash_3(window + i, s->hash_bits)] = NO_POSITION;
+        }
+    }
+    s->insert_index = 0;
+    s->skip_chunks = 0;
+}
+
+#ifdef HAVE_AVX2
+// match_length from len, 32 bytes at a time. stops where fewer than 32 bytes are left before max_len
+__attribute__((target("avx2")))
+static int match_length_avx2(const unsigned char *a, const unsigned char *b, int len, int max_len) {
+    for (; len + 32 <= max_len; len += 32) {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + len)),
+                                          _mm256_loadu_si256((const __m256i *)(b + len)));
+        uint32_t differ = ~(uint32_t)_mm256_movemask_epi8(equal);
+        if (differ != 0) {
+            return len + __builtin_ctz(differ);
+        }
+    }
+    return len;
+}
+#endif
+
+// the number of bytes a and b have in common, at most max_len, without reading past max_len.
+// 8 bytes are compared at a time, and the first which differs is the lowest set bit of their xor.
+// most repetitions end in the first 8 bytes, so only longer ones go on 32 bytes at a time with AVX2
+static inline int match_length(const unsigned char *a, const unsigned char *b, int max_len) {
+    int len = 0;
+    for (; len + 8 <= max_len; len += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + len, 8);
+        memcpy(&y, b + len, 8);
+        uint64_t differ = le64toh(x) ^ le64toh(y);
+        if (differ != 0) {
+            return len + (__builtin_ctzll(differ) >> 3);
+        }
+#ifdef HAVE_AVX2
+        if (has_avx2 && len == 0) {
+            len = match_length_avx2(a, b, 8, max_len);
+            if (len + 32 <= max_len) {
+                return len;
+            }
+            len -= 8;
+        }
+#endif
+    }
+    while (len < max_len && a[len] == b[len]) {
+        len++;
+    }
+    return len;
+}
+
+// finds the longest repetition of window position i, by following at most chain links of its hash chain
+// returns its length, or 0 if there is none
+// if found isn't NULL, every repetition which was the longest so far is added to it
+static int longest_repetition(int i, int chain, int *dist, struct candidates *found, struct state *s) {
+    const unsigned char *window = s->window;
+    // a repetition can't go past the end of the window, or be longer than MAX_REPEAT
+    int max_len = s->in_buf_index - i;
+    if (max_len > MAX_REPEAT) max_len = MAX_REPEAT;
+    if (max_len < 3) return 0;
+
+    int limit = i - s->window_size;
+    int best_repetition_length = 0;
+#ifdef DEFLATE_STATS
+    int probes = 0;
+#endif
+    for (int r = s->head[hash_3(window + i, s->hash_bits)]; r > limit && r != NO_POSITION && chain-- > 0;
+         r = s->prev[r & (s->window_size - 1)]) {
+        STATS(s->stats, probes += 1);
+        // positions come latest first, and the later repetition is preferred because it's less bits,
+        // so only a longer one replaces it. a repetition can only be longer if it matches at the current best length
+        if (window[r + best_repetition_length] != window[i + best_repetition_length]) {
+            continue;
+        }
+        int repeat_len = match_length(window + r, window + i, max_len);
+        if (repeat_len >= 3 && repeat_len > best_repetition_length) {
+            best_repetition_length = repeat_len;
+            *dist = i - r;
+            if (found != NULL) {
+                // when there's no more room, the longest replaces the last one
+                int k = found->count < MAX_CANDIDATES ? found->count++ : MAX_CANDIDATES - 1;
+                found->len[k] = repeat_len;
+                found->dist[k] = i - r;
+            }
+            if (repeat_len >= s->config->nice_length || repeat_len == max_len) {
+                break;
             }
         }
+    }
+    STATS(s->stats, stats_search(s->stats, probes));
+    return best_repetition_length;
+}
 
-        if (best_repetition_length != 0) {
-            s->repetition_len[i] = best_repetition_length;
-            s->repetition_dist[i] = i - best_repetition_r;
+// iterates from window position i to j, and finds the best repetitions
+// only positions which aren't covered by a previous repetition are set
+// returns the position after the last repetition, which may be past j
+static int find_repetitions(int i, int j, struct state *s) {
+    const struct level_config *config = s->config;
+    int len = -1; // length of the repetition at i, if it was already found
+    int dist = 0;
+    while (i < j) {
+        if (len < 0) {
+            insert_hashes(i, s);
+            len = longest_repetition(i, config->max_chain, &dist, NULL, s);
+        }
+        if (config->lazy && len != 0 && len < config->lazy_length && i + 1 < j) {
+            // lazy evaluation: if the next position has a longer repetition, write this character
+            // as-is and take that one instead
+            insert_hashes(i + 1, s);
+            int chain = len >= config->good_length ? config->max_chain >> 2 : config->max_chain;
+            int next_dist = 0;
+            int next_len = longest_repetition(i + 1, chain, &next_dist, NULL, s);
+            if (next_len > len) {
+                s->repetition_len[i - s->block_start] = 0;
+                i += 1;
+                len = next_len;
+                dist = next_dist;
+                continue;
+            }
+        }
+        s->repetition_len[i - s->block_start] = len;
+        s->repetition_dist[i - s->block_start] = dist;
+        if (len == 0) {
+            i += 1;
+        } else {
+            if (!config->lazy && len > config->lazy_length) {
+                // greedy levels don't spend time adding the inside of long repetitions to the hash chains,
+                // but their start goes in, so the chains still reach the latest repetition
+                insert_hashes(i + 1, s);
+                s->insert_index = i + len;
+            }
+            i += len;
         }
+        len = -1;
     }
+    return i;
 }
 
 static int binary_search(const int *arr, int R, int x) {
@@ -121,7 +367,6 @@ static int binary_search(const int *arr, int R, int x) {
     return L - 1;
 }
 
-// iterates from s->in_buf_index - i to s->in_buf_index - j, writes it using dynamic huffman
 static const int lengths_for_codes[29]   = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
                                              35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
 static const int lengths_for_repeats[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97,
@@ -134,142 +379,1314 @@ static const short dist_extra_bits[30] = {
     0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
     7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
     12, 12, 13, 13};
-static void dynamic_huffman(int i, int j, struct state *s) {
-    i = s->in_buf_index - i;
-    j = s->in_buf_index - j;
-    // step 1: choose the best repetitions...
-    // step 2: find how many times each character in 0-285 appears, and every distance code in 1-32,
-    // and calculate hlit (number of literal/length codes) and hdist (number of distance codes)
-    int hlit = 0;
-    int hdist = 0;
-    int dist_and_lit_huffman_appearances[286 + 32] = {0};
-    for (; i < j; i++) {
-        int replen = s->repetition_len[i];
-        if (replen != 0) {
-            // find correct length code with binary search
+
+// the order in which code length code lengths are written
+static const int code_length_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// huffman codes of a block
+struct block_codes {
+    int literal_lengths[288];
+    uint16_t literal_codes[288];
+    int distnce_lengths[30];
+    uint16_t distnce_codes[30];
+};
+
+// the code lengths of a dynamic huffman block, as written in its header
+struct dynamic_header {
+    int hlit;                  // number of literal/length codes
+    int hdist;                 // number of distance codes
+    int hclen;                 // number of code length codes
+    int count;                 // number of code length symbols
+    uint8_t symbols[286 + 30]; // code length symbols, 0-15 are lengths and 16-18 are repeats
+    uint8_t extra[286 + 30];   // extra bits value of every repeat symbol
+    int code_length_lengths[19];
+    uint16_t code_length_codes[19];
+};
+
+// what a range of window positions is encoded as, which is all that decides its size
+struct block_stats {
+    int literal_freqs[286]; // uses of every literal/length code, without the end of block code
+    int distnce_freqs[30];  // uses of every distance code
+    int extra_bits;         // bits after length and distance codes
+    int bytes;              // number of window positions
+};
+
+// counts the codes used from window position i to j, which must end after a repetition
+static void count_symbols(int i, int j, struct block_stats *stats, struct state *s) {
+    memset(stats, 0, sizeof(*stats));
+    stats->bytes = j - i;
+    while (i < j) {
+        int replen = s->repetition_len[i - s->block_start];
+        if (replen == 0) {
+            stats->literal_freqs[s->window[i]] += 1;
+            STATS(s->stats, s->stats->literals += 1);
+            i += 1;
+        } else {
             int lit = binary_search(lengths_for_codes, 29, replen);
-            dist_and_lit_huffman_appearances[257 + lit] += 1;
-            if ((lit + 1) > hlit) {
-                hlit = lit + 1;
-            }
-            // find correct repeat code with binary search
-            int dist = binary_search(lengths_for_repeats, 30, s->repetition_dist[i]);
-            dist_and_lit_huffman_appearances[286 + dist] += 1;
-            if ((dist + 1) > hdist) {
-                hdist = dist + 1;
-            }
+            int distcode = binary_search(lengths_for_repeats, 30, s->repetition_dist[i - s->block_start]);
+            stats->literal_freqs[257 + lit] += 1;
+            stats->distnce_freqs[distcode] += 1;
+            stats->extra_bits += lengths_extra_bits[lit] + dist_extra_bits[distcode];
+            STATS(s->stats, stats_match(s->stats, replen, s->repetition_dist[i - s->block_start]));
+            i += replen;
+        }
+    }
+}
+
+// adds the codes of b to a
+static void add_stats(struct block_stats *a, const struct block_stats *b) {
+    for (int x = 0; x < 286; x++) {
+        a->literal_freqs[x] += b->literal_freqs[x];
+    }
+    for (int x = 0; x < 30; x++) {
+        a->distnce_freqs[x] += b->distnce_freqs[x];
+    }
+    a->extra_bits += b->extra_bits;
+    a->bytes += b->bytes;
+}
+
+// number of bits the symbols take with these code lengths
+static int code_cost(const int *freqs, const int *lengths, int count) {
+    int bits = 0;
+    for (int x = 0; x < count; x++) {
+        bits += freqs[x] * lengths[x];
+    }
+    return bits;
+}
+
+#ifdef MAKEFIXED
+static struct block_codes fixed_block_codes;
+
+// builds the fixed huffman codes, which are otherwise in fixedencode.h
+static void fixed_codes(void) {
+    struct block_codes *codes = &fixed_block_codes;
+    int x;
+    for (x = 0; x < 144; ++x) {
+        codes->literal_lengths[x] = 8;
+    }
+    for (; x < 256; ++x) {
+        codes->literal_lengths[x] = 9;
+    }
+    for (; x < 280; ++x) {
+        codes->literal_lengths[x] = 7;
+    }
+    for (; x < 288; ++x) {
+        codes->literal_lengths[x] = 8;
+    }
+    huffman_codes(codes->literal_lengths, 288, codes->literal_codes);
+    for (x = 0; x < 30; ++x) {
+        codes->distnce_lengths[x] = 5;
+    }
+    huffman_codes(codes->distnce_lengths, 30, codes->distnce_codes);
+}
+
+static void print_table(FILE *out, const char *name, const int *lengths, const uint16_t *codes, int count) {
+    fprintf(out, "    .%s = {", name);
+    for (int x = 0; x < count; x++) {
+        fprintf(out, "%s", x % 12 ? " " : "\n        ");
+        if (lengths) {
+            fprintf(out, "%d,", lengths[x]);
         } else {
-            dist_and_lit_huffman_appearances[s->in_buf[i]] += 1;
-        }
-    }
-    // step 3: encode this efficiently with repetitions
-    // move dist_and_lit_huffman_appearances so distances are right after literals
-    memmove(dist_and_lit_huffman_appearances + hlit, dist_and_lit_huffman_appearances + 286, 32);
-    int dist_and_lit_huffman_repetitions[286 + 32] = {0};
-    int dalhr_i = 0;
-    for (int x = 0; x < hlit + hdist + 258;) {
-        // look for a repetition of the previous code length
-        if (dist_and_lit_huffman_appearances[x] == 0) {
-            int repeat_len = 0;
-            while (dist_and_lit_huffman_appearances[x + repeat_len] == 0 && repeat_len < 138) {
-                repeat_len += 1;
-            }
-            if (repeat_len >= 3) {
-                // this is a repetition
-                x += repeat_len;
-                if (x > 0 && dist_and_lit_huffman_appearances[x - 1] == 0 && repeat_len <= 6) {
-                    dist_and_lit_huffman_repetitions[dalhr_i++] = (16 << 7) | (repeat_len - 3);
-                } else if (repeat_len <= 10) {
-                    dist_and_lit_huffman_repetitions[dalhr_i++] = (17 << 7) | (repeat_len - 3);
-                } else {
-                    dist_and_lit_huffman_repetitions[dalhr_i++] = (18 << 7) | (repeat_len - 11);
-                }
-            } else {
-                dist_and_lit_huffman_repetitions[dalhr_i++] = dist_and_lit_huffman_appearances[x++];
-            }
-        } else if (x > 0) {
-            int prev = dist_and_lit_huffman_appearances[x - 1];
-            int repeat_len = 0;
-            while (dist_and_lit_huffman_appearances[x + repeat_len] == prev && repeat_len < 6) {
-                repeat_len += 1;
+            fprintf(out, "0x%04x,", codes[x]);
+        }
+    }
+    fprintf(out, "\n    },\n");
+}
+
+void makefixed_encode(FILE *out) {
+    fixed_codes();
+    const struct block_codes *codes = &fixed_block_codes;
+    fprintf(out, "// fixedencode.h -- fixed huffman codes for compressor.c\n");
+    fprintf(out, "// generated by makefixed.c, don't edit\n\n");
+    fprintf(out, "static const struct block_codes fixed_block_codes = {\n");
+    print_table(out, "literal_lengths", codes->literal_lengths, NULL, 288);
+    print_table(out, "literal_codes", NULL, codes->literal_codes, 288);
+    print_table(out, "distnce_lengths", codes->distnce_lengths, NULL, 30);
+    print_table(out, "distnce_codes", NULL, codes->distnce_codes, 30);
+    fprintf(out, "};\n");
+}
+#else
+#include "fixedencode.h"
+#endif
+
+static void add_code_length(int symbol, int extra, struct dynamic_header *h) {
+    h->symbols[h->count] = symbol;
+    h->extra[h->count] = extra;
+    h->count += 1;
+}
+
+// builds the header of a dynamic huffman block with these codes
+// returns the number of bits it takes, without the 3 bit block header
+static int dynamic_header(const struct block_codes *codes, struct dynamic_header *h) {
+    // literal/length and distance code lengths are written together, and trailing unused codes are left out
+    int lengths[286 + 30];
+    h->hlit = 286;
+    while (h->hlit > 257 && codes->literal_lengths[h->hlit - 1] == 0) h->hlit -= 1;
+    h->hdist = 30;
+    while (h->hdist > 1 && codes->distnce_lengths[h->hdist - 1] == 0) h->hdist -= 1;
+    memcpy(lengths, codes->literal_lengths, h->hlit * sizeof(int));
+    memcpy(lengths + h->hlit, codes->distnce_lengths, h->hdist * sizeof(int));
+
+    // encode runs of the same length: 16 repeats the previous length 3-6 times,
+    // 17 repeats 0 3-10 times and 18 repeats 0 11-138 times
+    h->count = 0;
+    int count = h->hlit + h->hdist;
+    for (int x = 0; x < count;) {
+        int len = lengths[x];
+        int run = 1;
+        while (x + run < count && lengths[x + run] == len) run++;
+        x += run;
+        if (len == 0) {
+            while (run >= 11) {
+                int repeat = run > 138 ? 138 : run;
+                add_code_length(18, repeat - 11, h);
+                run -= repeat;
             }
-            if (repeat_len >= 3) {
-                // this is a repetition
-                x += repeat_len;
-                dist_and_lit_huffman_repetitions[dalhr_i++] = (16 << 7) | (repeat_len - 3);
-            } else {
-                dist_and_lit_huffman_repetitions[dalhr_i++] = dist_and_lit_huffman_appearances[x++];
+            if (run >= 3) {
+                add_code_length(17, run - 3, h);
+                run = 0;
             }
         } else {
-            dist_and_lit_huffman_repetitions[dalhr_i++] = dist_and_lit_huffman_appearances[x++];
+            add_code_length(len, 0, h);
+            run -= 1;
+            while (run >= 3) {
+                int repeat = run > 6 ? 6 : run;
+                add_code_length(16, repeat - 3, h);
+                run -= repeat;
+            }
+        }
+        for (; run > 0; run--) {
+            add_code_length(len, 0, h);
         }
     }
-    // step 4: construct huffman code...
+
+    // the code lengths are written with their own huffman code, of at most 7 bits
+    int freqs[19] = {0};
+    for (int x = 0; x < h->count; x++) {
+        freqs[h->symbols[x]] += 1;
+    }
+    huffman_lengths(freqs, 19, 7, h->code_length_lengths);
+    huffman_codes(h->code_length_lengths, 19, h->code_length_codes);
+    h->hclen = 19;
+    while (h->hclen > 4 && h->code_length_lengths[code_length_order[h->hclen - 1]] == 0) h->hclen -= 1;
+
+    return 5 + 5 + 4 + 3 * h->hclen + code_cost(freqs, h->code_length_lengths, 19) +
+           2 * freqs[16] + 3 * freqs[17] + 7 * freqs[18];
+}
+
+static void write_dynamic_header(const struct dynamic_header *h, struct state *s) {
+    write_bits(h->hlit - 257, 5, s);
+    write_bits(h->hdist - 1, 5, s);
+    write_bits(h->hclen - 4, 4, s);
+    for (int x = 0; x < h->hclen; x++) {
+        write_bits(h->code_length_lengths[code_length_order[x]], 3, s);
+    }
+    for (int x = 0; x < h->count; x++) {
+        int symbol = h->symbols[x];
+        write_bits(h->code_length_codes[symbol], h->code_length_lengths[symbol], s);
+        if (symbol == 16) write_bits(h->extra[x], 2, s);
+        if (symbol == 17) write_bits(h->extra[x], 3, s);
+        if (symbol == 18) write_bits(h->extra[x], 7, s);
+    }
 }
 
-// iterates from s->in_buf_index - i to s->in_buf_index - j, writes it using fixed huffman
-static void fixed_huffman(int i, int j, struct state *s) {
-    i = s->in_buf_index - i;
-    j = s->in_buf_index - j;
-    write_bits(0b01, 2, s); // header
+// writes window positions i to j with the codes, and the end of block code
+static void write_symbols(int i, int j, const struct block_codes *codes, struct state *s) {
     while (i < j) {
-        int replen = s->repetition_len[i];
+        int replen = s->repetition_len[i - s->block_start];
         if (replen == 0) {
             // write character as-is
-            int lit = s->in_buf[i];
-            if (lit <= 143) {
-                // 8 bits - 00110000 through 10111111
-                write_bits(0b0011000 + lit, 8, s);
-            } else {
-                // 9 bits - 110010000 through 111111111
-                write_bits(0b110010000 + lit, 9, s);
-            }
+            int lit = s->window[i];
+            write_bits(codes->literal_codes[lit], codes->literal_lengths[lit], s);
             i += 1;
         } else {
             // write this repetition
-            int dist = s->repetition_dist[i];
-            int lencode = 257 + binary_search(lengths_for_codes, 29, replen);
-            if (lencode <= 279) {
-                // 7 bits - 0000000 through 0010111
-                write_bits(lencode - 256, 7, s);
+            int dist = s->repetition_dist[i - s->block_start];
+            int lit = binary_search(lengths_for_codes, 29, replen);
+            write_bits(codes->literal_codes[257 + lit], codes->literal_lengths[257 + lit], s);
+            // write extra bits based on the length code
+            write_bits(replen - lengths_for_codes[lit], lengths_extra_bits[lit], s);
+            int distcode = binary_search(lengths_for_repeats, 30, dist);
+            write_bits(codes->distnce_codes[distcode], codes->distnce_lengths[distcode], s);
+            write_bits(dist - lengths_for_repeats[distcode], dist_extra_bits[distcode], s);
+            i += replen;
+        }
+    }
+    write_bits(codes->literal_codes[256], codes->literal_lengths[256], s);
+}
+
+// writes window positions i to j as a non-compressed block
+static void write_stored(int i, int j, bool last, struct state *s) {
+    write_bits(last, 1, s);
+    write_bits(0b00, 2, s);
+    // skip to the next byte boundary
+    write_bits(0, (8 - s->bit_count) & 7, s);
+    write_bits(j - i, 16, s);
+    write_bits(~(j - i) & 0xffff, 16, s);
+    // the bit buffer is empty after the lengths, so the bytes are copied all at once
+    if (s->dry) {
+        s->out_len += j - i;
+        return;
+    }
+    if (s->out_cap - s->out_len < (size_t)(j - i)) {
+        longjmp(s->except, ERR_OUTPUT_TOO_SMALL);
+    }
+    memcpy(s->out + s->out_len, s->window + i, j - i);
+    s->out_len += j - i;
+}
+
+enum block_type { STORED, FIXED, DYNAMIC };
+
+static void dynamic_codes(const struct block_stats *stats, struct block_codes *codes) {
+    int literal_freqs[286];
+    memcpy(literal_freqs, stats->literal_freqs, sizeof(literal_freqs));
+    literal_freqs[256] = 1; // end of block
+    huffman_lengths(literal_freqs, 286, MAX_CODEBITS, codes->literal_lengths);
+    codes->literal_lengths[286] = codes->literal_lengths[287] = 0;
+    huffman_lengths(stats->distnce_freqs, 30, MAX_CODEBITS, codes->distnce_lengths);
+}
+
+// the exact number of bits a block with these stats takes as a block type, without writing it.
+// the block starts bit_count bits into a byte, which matters for non-compressed blocks
+static int block_cost(const struct block_stats *stats, enum block_type type, int bit_count) {
+    if (type == STORED) {
+        // starts on a byte boundary, with 4 bytes of lengths
+        return 3 + ((8 - (bit_count + 3)) & 7) + 32 + 8 * stats->bytes;
+    }
+    struct block_codes dynamic;
+    const struct block_codes *codes = &fixed_block_codes;
+    int header_bits = 3;
+#ifdef MAKEFIXED
+    fixed_codes();
+#endif
+    if (type == DYNAMIC) {
+        struct dynamic_header header;
+        dynamic_codes(stats, &dynamic);
+        header_bits += dynamic_header(&dynamic, &header);
+        codes = &dynamic;
+    }
+    return header_bits + stats->extra_bits + codes->literal_lengths[256] +
+           code_cost(stats->literal_freqs, codes->literal_lengths, 286) +
+           code_cost(stats->distnce_freqs, codes->distnce_lengths, 30);
+}
+
+// the cheapest block type for these stats
+// returns the number of bits it takes
+static int best_block(const struct block_stats *stats, int bit_count, enum block_type *best) {
+    int best_bits = block_cost(stats, STORED, bit_count);
+    *best = STORED;
+    for (enum block_type type = FIXED; type <= DYNAMIC; type++) {
+        int bits = block_cost(stats, type, bit_count);
+        if (bits < best_bits) {
+            best_bits = bits;
+            *best = type;
+        }
+    }
+    return best_bits;
+}
+
+// writes window positions i to j, which must end after a repetition, as a single block.
+// it's written non-compressed, with fixed huffman or with dynamic huffman, whichever is smallest
+static void write_block(int i, int j, bool last, const struct block_stats *stats, struct state *s) {
+    enum block_type type;
+    best_block(stats, s->bit_count, &type);
+    STATS(s->stats, s->stats->stored_blocks += type == STORED; s->stats->fixed_blocks += type == FIXED;
+                    s->stats->dynamic_blocks += type == DYNAMIC);
+    if (type == STORED) {
+        STATS(s->stats, s->stats->stored_bytes += j - i);
+        write_stored(i, j, last, s);
+        return;
+    }
+    struct block_codes dynamic;
+    const struct block_codes *codes = &fixed_block_codes;
+    write_bits(last, 1, s);
+    if (type == FIXED) {
+#ifdef MAKEFIXED
+        fixed_codes();
+#endif
+        write_bits(0b01, 2, s);
+    } else {
+        struct dynamic_header header;
+        dynamic_codes(stats, &dynamic);
+        dynamic_header(&dynamic, &header);
+        huffman_codes(dynamic.literal_lengths, 288, dynamic.literal_codes);
+        huffman_codes(dynamic.distnce_lengths, 30, dynamic.distnce_codes);
+        write_bits(0b10, 2, s);
+        write_dynamic_header(&header, s);
+        codes = &dynamic;
+    }
+    write_symbols(i, j, codes, s);
+}
+
+// Optimal parse
+// Every position is a node, and every literal and repetition from it is an edge to a later one, which
+// costs the bits it would be written with. The cheapest path through a chunk is the smallest way to write
+// it, as long as the costs are right. They depend on the codes, which depend on the path, so the parse runs
+// again with the codes of the last path, like zopfli.
+
+// estimated bits of every symbol
+struct symbol_costs {
+    int literal[256];            // literals
+    int length[MAX_REPEAT + 1];  // length codes, with their extra bits
+    int distnce[30];             // distance codes, without their extra bits
+};
+
+// costs of writing with codes. a code which isn't used gets the longest length, since it would have
+// to be added to the codes
+static void symbol_costs(const struct block_codes *codes, struct symbol_costs *costs) {
+    for (int x = 0; x < 256; x++) {
+        costs->literal[x] = codes->literal_lengths[x] ? codes->literal_lengths[x] : MAX_CODEBITS;
+    }
+    for (int len = 3; len <= MAX_REPEAT; len++) {
+        int lit = binary_search(lengths_for_codes, 29, len);
+        int bits = codes->literal_lengths[257 + lit] ? codes->literal_lengths[257 + lit] : MAX_CODEBITS;
+        costs->length[len] = bits + lengths_extra_bits[lit];
+    }
+    for (int x = 0; x < 30; x++) {
+        costs->distnce[x] = codes->distnce_lengths[x] ? codes->distnce_lengths[x] : MAX_CODEBITS;
+    }
+}
+
+// sets a step of a path at window position i, and counts its codes into stats
+static void set_step(int i, int len, int dist, struct block_stats *stats, struct state *s) {
+    if (len == 1) {
+        s->repetition_len[i - s->block_start] = 0;
+        stats->literal_freqs[s->window[i]] += 1;
+        return;
+    }
+    s->repetition_len[i - s->block_start] = len;
+    s->repetition_dist[i - s->block_start] = dist;
+    int lit = binary_search(lengths_for_codes, 29, len);
+    int distcode = binary_search(lengths_for_repeats, 30, dist);
+    stats->literal_freqs[257 + lit] += 1;
+    stats->distnce_freqs[distcode] += 1;
+    stats->extra_bits += lengths_extra_bits[lit] + dist_extra_bits[distcode];
+}
+
+// optimal: what the parse of a chunk needs, which is too much for the stack. it's allocated for the first
+// chunk, and kept in the state for the others
+struct optimal_chunk {
+    struct candidates found[SPLIT_SIZE]; // candidates of every position
+    uint32_t bits[SPLIT_SIZE + 1];       // cheapest bits from i to every position
+    uint16_t step_len[SPLIT_SIZE + 1];   // length of the last step of that path, 1 for a literal
+    uint16_t step_dist[SPLIT_SIZE + 1];  // distance of the last step, if it's a repetition
+};
+
+// finds the cheapest path from window position i to j, at most SPLIT_SIZE apart, through the candidates
+// of every position. sets the repetitions of the path, and counts its codes into stats
+// returns the position after the last repetition, which may be past j
+static int optimal_parse(int i, int j, struct optimal_chunk *chunk, const struct symbol_costs *costs,
+                         struct block_stats *stats, struct state *s) {
+    const struct candidates *found = chunk->found;
+    uint32_t *bits = chunk->bits;
+    uint16_t *step_len = chunk->step_len;
+    uint16_t *step_dist = chunk->step_dist;
+    int n = j - i;
+    // the path can also end with a repetition which goes past j, instead of being cut short there
+    uint32_t past_bits = UINT32_MAX;
+    int past_from = 0, past_len = 0, past_dist = 0;
+    bits[0] = 0;
+    for (int k = 1; k <= n; k++) {
+        bits[k] = UINT32_MAX;
+    }
+    for (int k = 0; k < n; k++) {
+        uint32_t literal = bits[k] + costs->literal[s->window[i + k]];
+        if (literal < bits[k + 1]) {
+            bits[k + 1] = literal;
+            step_len[k + 1] = 1;
+        }
+        // every length up to the longest candidate, with the nearest distance which reaches it
+        const struct candidates *c = &found[k];
+        int len = 3;
+        for (int x = 0; x < c->count; x++) {
+            int distcode = binary_search(lengths_for_repeats, 30, c->dist[x]);
+            uint32_t start = bits[k] + costs->distnce[distcode] + dist_extra_bits[distcode];
+            int max_len = c->len[x] < n - k ? c->len[x] : n - k;
+            for (; len <= max_len; len++) {
+                uint32_t repetition = start + costs->length[len];
+                if (repetition < bits[k + len]) {
+                    bits[k + len] = repetition;
+                    step_len[k + len] = len;
+                    step_dist[k + len] = c->dist[x];
+                }
+            }
+            for (; len <= c->len[x]; len++) {
+                uint32_t repetition = start + costs->length[len];
+                if (repetition < past_bits) {
+                    past_bits = repetition;
+                    past_from = k;
+                    past_len = len;
+                    past_dist = c->dist[x];
+                }
+            }
+        }
+    }
+
+    // walk the path back from its end. a path which ends with a repetition past j covers more bytes, and is
+    // taken if it costs no more than the one which ends at j. the two don't cover the same span, but the one
+    // ending at j doesn't lose much by it: the next chunk starts at j, where the same repetition usually
+    // goes on at the same distance, for about one length and distance code more. comparing their bits per
+    // byte instead changed the output of bench by less than 0.01%
+    memset(stats, 0, sizeof(*stats));
+    int end = n;
+    if (past_bits <= bits[n]) {
+        set_step(i + past_from, past_len, past_dist, stats, s);
+        end = past_from + past_len;
+        n = past_from;
+    }
+    stats->bytes = end;
+    for (int k = n; k > 0; k -= step_len[k]) {
+        set_step(i + k - step_len[k], step_len[k], step_dist[k], stats, s);
+    }
+    return i + end;
+}
+
+// finds the repetitions from window position i to j, at most SPLIT_SIZE apart, like find_repetitions,
+// but by the optimal parse. the candidates of every position are found once, and the parse runs
+// config->passes times, first with the fixed codes, and then with the codes of the path before
+// returns the position after the last repetition, which may be past j
+static int find_optimal_repetitions(int i, int j, struct state *s) {
+    if (s->optimal == NULL) {
+        s->optimal = malloc(sizeof(struct optimal_chunk));
+        if (s->optimal == NULL) {
+            longjmp(s->except, ERR_NO_MEMORY);
+        }
+    }
+    struct optimal_chunk *chunk = s->optimal;
+    for (int k = i; k < j; k++) {
+        int dist;
+        insert_hashes(k, s);
+        chunk->found[k - i].count = 0;
+        longest_repetition(k, s->config->max_chain, &dist, &chunk->found[k - i], s);
+    }
+    struct symbol_costs costs;
+    struct block_stats stats;
+    struct block_codes codes;
+#ifdef MAKEFIXED
+    fixed_codes();
+#endif
+    symbol_costs(&fixed_block_codes, &costs);
+    int end = j;
+    for (int pass = 0; pass < s->config->passes; pass++) {
+        if (pass > 0) {
+            dynamic_codes(&stats, &codes);
+            symbol_costs(&codes, &costs);
+        }
+        end = optimal_parse(i, j, chunk, &costs, &stats, s);
+    }
+    return end;
+}
+
+// sets up the matcher for a level and a window of 1 << window_bits bytes, with its tables in
+// TABLE_ENTRIES(window_bits) entries of memory: the hash heads, the chains, and the repetitions of a block
+static void init_matcher(int level, int window_bits, uint16_t *tables, struct state *s) {
+    if (level < 1) level = 1;
+    if (level > MAX_LEVEL) level = MAX_LEVEL;
+    pthread_once(&cpu_once, cpu_init);
+    s->config = &level_configs[level];
+    s->insert_index = 0;
+    s->window_size = 1 << window_bits;
+    s->block_size = 1 << TABLE_BITS(window_bits);
+    s->hash_bits = TABLE_BITS(window_bits);
+    s->head = tables;
+    s->prev = s->head + (1 << s->hash_bits);
+    s->repetition_len = s->prev + s->window_size;
+    s->repetition_dist = s->repetition_len + s->block_size;
+    memset(s->head, 0, (1 << s->hash_bits) * sizeof(uint16_t));
+    s->skip_chunks = 0;
+    s->optimal = NULL;
+#ifdef DEFLATE_STATS
+    s->stats = NULL;
+#endif
+}
+
+// frees what the matcher allocated while compressing, when the state is done with, or before init_matcher
+// sets it up again
+static void free_matcher(struct state *s) {
+    free(s->optimal);
+    s->optimal = NULL;
+}
+
+// compresses window positions i to j, block by block
+// repetitions are found SPLIT_SIZE positions at a time, and every such chunk either joins the current
+// block, or starts a new one if the two are smaller apart, because the data changed
+// data which doesn't compress, like compressed or encrypted data, would take most of the time to search
+// for repetitions which aren't there. so after a whole chunk comes out non-compressed, the next SKIP_CHUNKS
+// chunks are taken as literals. that's still enough to see if their bytes compress on their own, like text,
+// and then searching starts again from the next chunk. a probe every SKIP_SAMPLE positions also sees if
+// they repeat what came before, and then the chunk is searched after all
+// if last, j is the end of the input, and the last block is marked as final
+// returns the position after the last repetition, which may be past j
+static int compress_range(int i, int j, bool last, struct state *s) {
+    struct block_stats block, chunk, joined;
+    int start = i; // first position of the current block
+    int block_bits = 0;
+    memset(&block, 0, sizeof(block));
+    s->block_start = i;
+    while (i < j) {
+        if (i - start >= s->block_size) {
+            write_block(start, i, false, &block, s);
+            memset(&block, 0, sizeof(block));
+            start = s->block_start = i;
+        }
+        int chunk_end = i + SPLIT_SIZE;
+        if (chunk_end > j) chunk_end = j;
+        if (chunk_end > start + s->block_size) chunk_end = start + s->block_size;
+        int end = chunk_end;
+        bool searched = s->skip_chunks == 0;
+        if (!searched) {
+            // the probes only reach positions before the chunk, which aren't ahead of any position in it
+            insert_hashes(i, s);
+            int repeated = 0;
+            for (int k = i; k < chunk_end; k += SKIP_SAMPLE) {
+                int dist;
+                repeated += longest_repetition(k, 1, &dist, NULL, s);
+            }
+            s->skip_chunks -= 1;
+            searched = repeated * SKIP_SAMPLE >= (chunk_end - i) / 8;
+            if (searched) {
+                s->skip_chunks = 0;
             } else {
-                // 8 bits - 11000000 through 11000111
-                write_bits(0b11000000 + lencode - 280, 8, s);
+                memset(s->repetition_len + (i - s->block_start), 0, (chunk_end - i) * sizeof(uint16_t));
+                insert_hashes(chunk_end, s);
             }
-            // write extra bits based on lencode
-            write_bits(replen - lengths_for_codes[lencode - 257], lengths_extra_bits[lencode], s);
-            int distcode = 1 + binary_search(lengths_for_repeats, 30, dist);
-            write_bits(distcode, 5, s);
-            write_bits(dist - lengths_for_repeats[distcode - 1], lengths_extra_bits[distcode], s);
-            i += replen;
         }
+        if (searched) {
+            end = s->config->passes ? find_optimal_repetitions(i, chunk_end, s) : find_repetitions(i, chunk_end, s);
+        }
+        count_symbols(i, end, &chunk, s);
+
+        enum block_type type;
+        int chunk_bits = best_block(&chunk, s->bit_count, &type);
+        if (type != STORED) {
+            s->skip_chunks = 0;
+        } else if (searched && end - i >= SPLIT_SIZE) {
+            s->skip_chunks = SKIP_CHUNKS;
+        }
+        joined = block;
+        add_stats(&joined, &chunk);
+        int joined_bits = best_block(&joined, s->bit_count, &type);
+        if (i > start && block_bits + chunk_bits < joined_bits) {
+            write_block(start, i, false, &block, s);
+            // the chunk's repetitions move to the start of the arrays
+            memmove(s->repetition_len, s->repetition_len + (i - s->block_start), (chunk_end - i) * sizeof(uint16_t));
+            memmove(s->repetition_dist, s->repetition_dist + (i - s->block_start), (chunk_end - i) * sizeof(uint16_t));
+            start = s->block_start = i;
+            block = chunk;
+            block_bits = best_block(&block, s->bit_count, &type);
+        } else {
+            block = joined;
+            block_bits = joined_bits;
+        }
+        i = end;
     }
-    write_bits(0, 7, s); // 256
+    if (i > start || last) {
+        write_block(start, i, last, &block, s);
+    }
+    return i;
 }
 
-int compressor(FILE *dest, FILE *src) {
-    struct state *s = malloc(sizeof(struct state));
-    s->src = src;
-    s->dest = dest;
+struct compressor_stream {
+    struct state s;   // out is the output which wasn't given to the caller yet
+    uint16_t tables[TABLE_ENTRIES(MAX_WINDOW_BITS)];
+    size_t out_given; // bytes of out before this were given to the caller
+    int index;        // next window position to compress
+    bool synced;      // whether all input so far was flushed
+    bool finished;    // whether the final block was written
+};
+
+struct compressor_stream *compressor_stream_new(int level) {
+    struct compressor_stream *c = malloc(sizeof(struct compressor_stream));
+    if (c == NULL) {
+        return NULL;
+    }
+    struct state *s = &c->s;
+    s->dry = false;
     s->bit_buf = 0;
     s->bit_count = 0;
+    // one call compresses at most a whole window, and all of it is kept until the caller takes it
+    s->out_cap = deflate_compress_bound(STREAM_WINDOW) + 5;
+    s->out = malloc(s->out_cap);
+    s->out_len = 0;
+    s->in_buf = malloc(STREAM_WINDOW);
+    s->window = s->in_buf;
     s->in_buf_index = 0;
-    // read 127 "chunks" of 258 per block, which is the maximum repeat length. only then can we find the best repetitions.
-    for (int i = 0; i < 127; i++) {
-        for (int j = 0; !s->eof && (j < 258); j++) {
-            read_byte(s);
-        }
-        if (s->eof) {
-            // file ended already :(
-            find_repetitions(s->in_buf_index, 0, s);
-            // last chunk bit
-            write_bits(1, 1, s);
-            fixed_huffman(s->in_buf_index, 0, s);
+    init_matcher(level, MAX_WINDOW_BITS, c->tables, s);
+    if (s->out == NULL || s->in_buf == NULL) {
+        compressor_stream_free(c);
+        return NULL;
+    }
+    c->out_given = 0;
+    c->index = 0;
+    c->synced = true;
+    c->finished = false;
+    return c;
+}
+
+void compressor_stream_set_dictionary(struct compressor_stream *c, const void *dict, size_t len) {
+    struct state *s = &c->s;
+    if (len > WINDOW_SIZE) {
+        dict = (const unsigned char *)dict + len - WINDOW_SIZE;
+        len = WINDOW_SIZE;
+    }
+    // the dictionary is the start of the window, and compressing starts after it
+    memcpy(s->in_buf, dict, len);
+    s->in_buf_index = len;
+    c->index = len;
+    insert_hashes(len, s);
+}
+
+#ifdef DEFLATE_STATS
+void compressor_stream_set_stats(struct compressor_stream *c, struct deflate_stats *stats) {
+    c->s.stats = stats;
+}
+#endif
+
+void compressor_stream_free(struct compressor_stream *c) {
+    free_matcher(&c->s);
+    free(c->s.out);
+    free(c->s.in_buf);
+    free(c);
+}
+
+int compressor_stream_run(struct compressor_stream *c, const void *in, size_t in_len, size_t *in_used,
+                          void *out, size_t out_cap, size_t *out_len, int flush) {
+    struct state *s = &c->s;
+    *in_used = 0;
+    *out_len = 0;
+    int exception = setjmp(s->except);
+    if (exception != 0) {
+        return exception;
+    }
+    for (;;) {
+        // give the caller the output
+        size_t span = s->out_len - c->out_given;
+        if (span > out_cap - *out_len) {
+            span = out_cap - *out_len;
+        }
+        if (span > 0) {
+            memcpy((unsigned char *)out + *out_len, s->out + c->out_given, span);
+            *out_len += span;
+            c->out_given += span;
+        }
+        if (c->out_given < s->out_len) {
+            return COMPRESS_NEED_OUTPUT;
+        }
+        s->out_len = c->out_given = 0;
+        if (c->finished) {
+            return COMPRESS_DONE;
+        }
+
+        // fill the window
+        span = STREAM_WINDOW - s->in_buf_index;
+        if (span > in_len - *in_used) {
+            span = in_len - *in_used;
+        }
+        if (span > 0) {
+            memcpy(s->in_buf + s->in_buf_index, (const unsigned char *)in + *in_used, span);
+            s->in_buf_index += span;
+            *in_used += span;
+            c->synced = false;
+        }
+
+        if (s->in_buf_index == STREAM_WINDOW) {
+            // like compress_buffer, compress until only MAX_REPEAT bytes are left, and move the window
+            // forward by WINDOW_SIZE
+            c->index = compress_range(c->index, STREAM_WINDOW - MAX_REPEAT, false, s);
+            memmove(s->in_buf, s->in_buf + WINDOW_SIZE, STREAM_WINDOW - WINDOW_SIZE);
+            s->in_buf_index -= WINDOW_SIZE;
+            c->index -= WINDOW_SIZE;
+            slide_hashes(s);
+        } else if (flush == COMPRESS_FINISH) {
+            c->index = compress_range(c->index, s->in_buf_index, true, s);
+            flush_bits(s);
+            c->finished = true;
+        } else if (flush == COMPRESS_SYNC_FLUSH && !c->synced) {
+            // an empty non-compressed block ends on a byte boundary
+            c->index = compress_range(c->index, s->in_buf_index, false, s);
+            write_stored(c->index, c->index, false, s);
+            c->synced = true;
+        } else {
+            return COMPRESS_NEED_INPUT;
+        }
+    }
+}
+
+int compressor(FILE *dest, FILE *src) {
+    return compressor_ex(dest, src, DEFAULT_LEVEL);
+}
+
+int compressor_ex(FILE *dest, FILE *src, int level) {
+    struct deflate_sink sink = deflate_sink_file(dest);
+    return compressor_sink(&sink, src, level, FORMAT_RAW);
+}
+
+// writes the header before the deflate data
+static int write_container_header(const struct deflate_sink *dest, int level, int format,
+                                  const void *dict, size_t dict_len) {
+    if (format == FORMAT_ZLIB) {
+        // deflate with a 32K window, how hard it was compressed in 2 bits, whether there is a preset
+        // dictionary, and a check making the 16 bits a multiple of 31. the dictionary's adler-32 is after them
+        int flevel = level <= 1 ? 0 : level <= 5 ? 1 : level == 6 ? 2 : 3;
+        uint32_t id = dict != NULL ? adler32_update(ADLER32_INIT, dict, dict_len) : 0;
+        unsigned char header[6] = { 0x78, flevel << 6 | (dict != NULL) << 5, id >> 24, id >> 16, id >> 8, id };
+        header[1] += 31 - (header[0] * 256 + header[1]) % 31;
+        return dest->write(dest->context, header, dict != NULL ? 6 : 2);
+    } else if (format == FORMAT_GZIP) {
+        // magic, deflate, no flags or time, extra flags for the fastest and smallest levels, and unix
+        unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, level >= 9 ? 2 : level <= 1 ? 4 : 0, 3 };
+        return dest->write(dest->context, header, 10);
+    }
+    return 0;
+}
+
+// writes the trailer after the deflate data, with the checksum and length of the input
+static int write_container_trailer(const struct deflate_sink *dest, int format, uint32_t check, uint32_t size) {
+    if (format == FORMAT_ZLIB) {
+        unsigned char trailer[4] = { check >> 24, check >> 16, check >> 8, check };
+        return dest->write(dest->context, trailer, 4);
+    } else if (format == FORMAT_GZIP) {
+        unsigned char trailer[8] = { check, check >> 8, check >> 16, check >> 24, size, size >> 8, size >> 16, size >> 24 };
+        return dest->write(dest->context, trailer, 8);
+    }
+    return 0;
+}
+
+int compressor_sink(const struct deflate_sink *dest, FILE *src, int level, int format) {
+    return compressor_sink_dict(dest, src, level, format, NULL, 0);
+}
+
+// adds len bytes at p to the checksum of the container, if it has one
+static uint32_t update_check(int format, uint32_t check, const unsigned char *p, size_t len) {
+    if (format == FORMAT_ZLIB) {
+        return adler32_update(check, p, len);
+    } else if (format == FORMAT_GZIP) {
+        return crc32_update(check, p, len);
+    }
+    return check;
+}
+
+// compresses from src, or from mapping if it isn't NULL, to a sink
+static int compress_input(const struct deflate_sink *dest, FILE *src, const struct deflate_mapping *mapping,
+                          int level, int format, const void *dict, size_t dict_len) {
+    struct compressor_stream *c = compressor_stream_new(level);
+    if (c == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    if (format == FORMAT_GZIP) {
+        dict = NULL;
+    }
+    if (dict != NULL) {
+        compressor_stream_set_dictionary(c, dict, dict_len);
+    }
+    unsigned char buf[16384];
+    size_t mapped = 0; // bytes of mapping given to the stream
+    uint32_t check = format == FORMAT_ZLIB ? ADLER32_INIT : CRC32_INIT;
+    uint32_t size = 0; // input length, modulo 2^32
+    int result = write_container_header(dest, level, format, dict, dict_len);
+    while (result == 0) {
+        const unsigned char *in = buf;
+        size_t in_len;
+        if (mapping != NULL) {
+            // the stream is given the mapping in place, as much as a read would give
+            in = mapping->data + mapped;
+            in_len = mapping->len - mapped < sizeof(buf) ? mapping->len - mapped : sizeof(buf);
+            mapped += in_len;
+        } else {
+            in_len = fread(buf, 1, sizeof(buf), src);
+            if (in_len < sizeof(buf) && ferror(src)) {
+                // the input didn't end, it failed, so the output would be cut short
+                result = ERR_READ;
+                break;
+            }
+        }
+        int flush = in_len < sizeof(buf) ? COMPRESS_FINISH : COMPRESS_NO_FLUSH;
+        check = update_check(format, check, in, in_len);
+        size += in_len;
+        size_t in_given = 0;
+        do {
+            // no room is given, so the output stays in the stream, and the sink gets it from there in one span
+            size_t in_used, out_len;
+            result = compressor_stream_run(c, in + in_given, in_len - in_given, &in_used, NULL, 0, &out_len, flush);
+            in_given += in_used;
+            if (c->s.out_len > c->out_given) {
+                int error = dest->write(dest->context, c->s.out + c->out_given, c->s.out_len - c->out_given);
+                if (error != 0) {
+                    result = error;
+                    break;
+                }
+                c->out_given = c->s.out_len;
+            }
+        } while (result == COMPRESS_NEED_OUTPUT);
+        if (result == COMPRESS_DONE) {
+            result = write_container_trailer(dest, format, check, size);
             break;
+        } else if (result == COMPRESS_NEED_INPUT) {
+            result = 0;
         }
     }
+    compressor_stream_free(c);
+    return result;
+}
 
+int compressor_sink_dict(const struct deflate_sink *dest, FILE *src, int level, int format,
+                         const void *dict, size_t dict_len) {
+    return compress_input(dest, src, NULL, level, format, dict, dict_len);
+}
+
+size_t deflate_compress_bound(size_t in_len) {
+    // at worst, every byte is a 9 bit literal, plus a header and end of block code for every block
+    return in_len + in_len / 8 + 2 * (in_len / BLOCK_SIZE) + 8;
+}
+
+// compresses the input buffer, which the state's window points to, from position start.
+// the start positions before it (at most window_size) are only used for repetitions.
+// if final, the last block is marked as final, otherwise the output ends with an empty
+// non-compressed block, so more blocks can be written after it.
+// if check isn't NULL, the input from start is added to it for the container of format, a window at a time
+// right after it's compressed, so it's still in the cache
+static void compress_buffer_check(int start, size_t in_len, bool final, int format, uint32_t *check,
+                                  struct state *s) {
+    // the window is the next 2 * window_size bytes of the input, which is as many positions as the
+    // 16 bit hash chains have. positions are compressed until only MAX_REPEAT bytes are left after them,
+    // then the window moves forward by window_size. that keeps window_size bytes before every position,
+    // except the first MAX_REPEAT after a move, which reach a little less far back
+    int size = s->window_size;
+    size_t left = in_len;
+    int i = start;
+    const unsigned char *checked = s->window + start; // the input before this is in check
+    for (;;) {
+        bool last = left <= 2 * (size_t)size;
+        s->in_buf_index = last ? (int)left : 2 * size;
+        i = compress_range(i, last ? s->in_buf_index : 2 * size - MAX_REPEAT, last && final, s);
+        if (check != NULL) {
+            const unsigned char *end = s->window + (last ? s->in_buf_index : i);
+            *check = update_check(format, *check, checked, end - checked);
+            checked = end;
+        }
+        if (last) {
+            if (!final) write_stored(i, i, false, s);
+            break;
+        }
+        s->window += size;
+        left -= size;
+        i -= size;
+        slide_hashes(s);
+    }
     flush_bits(s);
-    free(s);
+}
+
+static void compress_buffer(int start, size_t in_len, bool final, struct state *s) {
+    compress_buffer_check(start, in_len, final, FORMAT_RAW, NULL, s);
+}
+
+_Static_assert(TABLE_ENTRIES(MAX_WINDOW_BITS) * sizeof(uint16_t) == DEFLATE_COMPRESS_WORKSPACE_SIZE,
+               "the workspace is the matcher's tables");
+
+int deflate_compress_buffer_workspace(const void *in, size_t in_len, void *out, size_t out_cap, size_t *out_len,
+                                      void *workspace) {
+    struct state s;
+    s.dry = false;
+    s.bit_buf = 0;
+    s.bit_count = 0;
+    s.out = out;
+    s.out_len = 0;
+    s.out_cap = out_cap;
+    s.in_buf = NULL;
+    s.window = in;
+    s.in_buf_index = 0;
+    init_matcher(DEFAULT_LEVEL, MAX_WINDOW_BITS, workspace, &s);
+    *out_len = 0;
+    int exception = setjmp(s.except);
+    if (exception != 0) {
+        return exception;
+    }
+    compress_buffer(0, in_len, true, &s);
+    *out_len = s.out_len;
+    return 0;
+}
+
+int deflate_compress_buffer(const void *in, size_t in_len, void *out, size_t out_cap, size_t *out_len) {
+    uint16_t tables[TABLE_ENTRIES(MAX_WINDOW_BITS)];
+    return deflate_compress_buffer_workspace(in, in_len, out, out_cap, out_len, tables);
+}
+
+size_t deflate_compress_size(const void *in, size_t in_len) {
+    struct state s;
+    uint16_t tables[TABLE_ENTRIES(MAX_WINDOW_BITS)];
+    s.dry = true;
+    s.bit_buf = 0;
+    s.bit_count = 0;
+    s.out = NULL;
+    s.out_len = 0;
+    s.out_cap = 0;
+    s.in_buf = NULL;
+    s.window = in;
+    s.in_buf_index = 0;
+    init_matcher(DEFAULT_LEVEL, MAX_WINDOW_BITS, tables, &s);
+    compress_buffer(0, in_len, true, &s);
+    return s.out_len;
+}
+
+// the most bytes a container adds around the deflate data
+#define CONTAINER_SIZE 18
+
+// compresses a whole mapped input into out, which is deflate_compress_bound of it and CONTAINER_SIZE long,
+// with the container around it
+// Returns 0 if successful, otherwise an error code
+static int compress_mapped(const struct deflate_mapping *input, unsigned char *out, size_t out_cap,
+                           size_t *out_len, int level, int format) {
+    struct state s;
+    struct deflate_memory container;
+    struct deflate_sink sink = deflate_sink_memory(&container);
+    memset(&container, 0, sizeof(container));
+    int result = write_container_header(&sink, level, format, NULL, 0);
+    uint16_t *tables = malloc(TABLE_ENTRIES(MAX_WINDOW_BITS) * sizeof(uint16_t));
+    if (result != 0 || tables == NULL) {
+        free(container.data);
+        free(tables);
+        return result != 0 ? result : ERR_NO_MEMORY;
+    }
+    memcpy(out, container.data, container.len);
+    s.dry = false;
+    s.bit_buf = 0;
+    s.bit_count = 0;
+    s.out = out + container.len;
+    s.out_len = 0;
+    s.out_cap = out_cap - container.len;
+    s.in_buf = NULL;
+    s.window = input->data;
+    s.in_buf_index = 0;
+    init_matcher(level, MAX_WINDOW_BITS, tables, &s);
+    result = setjmp(s.except);
+    if (result == 0) {
+        // raw data has no checksum, so it's only read by the compressor
+        uint32_t check = format == FORMAT_ZLIB ? ADLER32_INIT : CRC32_INIT;
+        compress_buffer_check(0, input->len, true, format, format != FORMAT_RAW ? &check : NULL, &s);
+        *out_len = container.len + s.out_len;
+        container.len = 0;
+        result = write_container_trailer(&sink, format, check, input->len);
+        memcpy(out + *out_len, container.data, container.len);
+        *out_len += container.len;
+    }
+    free_matcher(&s);
+    free(container.data);
+    free(tables);
+    return result;
+}
+
+int deflate_compress_file(const char *dest, const char *src, int level, int format) {
+    int in = src != NULL ? open(src, O_RDONLY) : STDIN_FILENO;
+    if (in < 0) {
+        return ERR_READ;
+    }
+    int out = dest != NULL ? open(dest, O_RDWR | O_CREAT | O_TRUNC, 0666) : STDOUT_FILENO;
+    if (out < 0) {
+        if (src != NULL) close(in);
+        return ERR_WRITE;
+    }
+    struct deflate_mapping input;
+    struct deflate_sink sink = deflate_sink_fd(out);
+    int result;
+    if (deflate_map_input(in, &input)) {
+        size_t cap = deflate_compress_bound(input.len) + CONTAINER_SIZE;
+        unsigned char *output = deflate_map_output(out, cap);
+        if (output != NULL) {
+            // the whole input and output are in memory, so nothing is copied
+            size_t out_len = 0;
+            result = compress_mapped(&input, output, cap, &out_len, level, format);
+            int error = deflate_unmap_output(out, output, cap, out_len);
+            if (result == 0) result = error;
+        } else {
+            result = compress_input(&sink, NULL, &input, level, format, NULL, 0);
+        }
+        deflate_unmap_input(&input);
+    } else {
+        FILE *file = src != NULL ? fdopen(in, "rb") : stdin;
+        result = file != NULL ? compress_input(&sink, file, NULL, level, format, NULL, 0) : ERR_READ;
+        if (file != NULL && src != NULL) {
+            fclose(file);
+            in = -1;
+        }
+    }
+    if (src != NULL && in >= 0) close(in);
+    if (dest != NULL) close(out);
+    return result;
+}
+
+struct compressor_context {
+    struct state s;
+    unsigned char *buf;          // the dictionary, then the message being compressed. NULL without a dictionary
+    size_t buf_cap;              // size of buf
+    int dictionary_len;          // bytes of dictionary at the start of buf
+    int dictionary_insert;       // insert_index after the dictionary was added to the hash chains
+    uint16_t *dictionary_tables; // head, then prev of the dictionary's positions, after it was added to the hash chains
+    uint16_t tables[];           // TABLE_ENTRIES of the context's window bits
+};
+
+struct compressor_context *compressor_context_new(int level, int window_bits) {
+    if (window_bits < MIN_WINDOW_BITS) window_bits = MIN_WINDOW_BITS;
+    if (window_bits > MAX_WINDOW_BITS) window_bits = MAX_WINDOW_BITS;
+    struct compressor_context *c = malloc(sizeof(struct compressor_context) +
+                                          TABLE_ENTRIES(window_bits) * sizeof(uint16_t));
+    if (c == NULL) {
+        return NULL;
+    }
+    init_matcher(level, window_bits, c->tables, &c->s);
+    c->buf = NULL;
+    c->buf_cap = 0;
+    c->dictionary_len = 0;
+    c->dictionary_tables = NULL;
+    return c;
+}
+
+#ifdef DEFLATE_STATS
+void compressor_context_set_stats(struct compressor_context *c, struct deflate_stats *stats) {
+    c->s.stats = stats;
+}
+#endif
+
+void compressor_context_free(struct compressor_context *c) {
+    free_matcher(&c->s);
+    free(c->buf);
+    free(c->dictionary_tables);
+    free(c);
+}
+
+int compressor_context_set_dictionary(struct compressor_context *c, const void *dict, size_t len) {
+    struct state *s = &c->s;
+    int head_size = 1 << s->hash_bits;
+    free(c->buf);
+    free(c->dictionary_tables);
+    c->buf = NULL;
+    c->buf_cap = 0;
+    c->dictionary_len = 0;
+    c->dictionary_tables = NULL;
+    memset(s->head, 0, head_size * sizeof(uint16_t));
+    s->insert_index = 0;
+    if (dict == NULL || len == 0) {
+        return 0;
+    }
+    if (len > (size_t)s->window_size) {
+        dict = (const unsigned char *)dict + len - s->window_size;
+        len = s->window_size;
+    }
+    c->buf = malloc(len);
+    c->dictionary_tables = malloc((head_size + len) * sizeof(uint16_t));
+    if (c->buf == NULL || c->dictionary_tables == NULL) {
+        compressor_context_set_dictionary(c, NULL, 0);
+        return ERR_NO_MEMORY;
+    }
+    memcpy(c->buf, dict, len);
+    c->buf_cap = len;
+    c->dictionary_len = len;
+    s->window = c->buf;
+    s->in_buf_index = len;
+    insert_hashes(len, s);
+    c->dictionary_insert = s->insert_index;
+    memcpy(c->dictionary_tables, s->head, head_size * sizeof(uint16_t));
+    memcpy(c->dictionary_tables + head_size, s->prev, len * sizeof(uint16_t));
     return 0;
 }
+
+// puts a message after the dictionary, where the hash chains are as they were after it, see restore_hashes
+// Returns 0 if successful, otherwise an error code
+static int load_message(struct compressor_context *c, const void *in, size_t in_len) {
+    size_t len = c->dictionary_len + in_len;
+    if (len > c->buf_cap) {
+        unsigned char *buf = realloc(c->buf, len);
+        if (buf == NULL) {
+            return ERR_NO_MEMORY;
+        }
+        c->buf = buf;
+        c->buf_cap = len;
+    }
+    memcpy(c->buf + c->dictionary_len, in, in_len);
+    return 0;
+}
+
+// puts the hash chains back as they were after the dictionary, for the next message. like clear_hashes,
+// only the heads of the message's positions are put back when it's short. the prev of the dictionary's
+// positions is only put back when the message's positions went round to it, and the message's own
+// aren't reached from the dictionary's heads
+static void restore_hashes(struct compressor_context *c) {
+    struct state *s = &c->s;
+    int head_size = 1 << s->hash_bits;
+    if (s->window != c->buf || s->insert_index > s->window_size ||
+        s->insert_index - c->dictionary_insert > head_size / 4) {
+        memcpy(s->head, c->dictionary_tables, head_size * sizeof(uint16_t));
+        memcpy(s->prev, c->dictionary_tables + head_size, c->dictionary_len * sizeof(uint16_t));
+    } else {
+        int end = s->insert_index < s->in_buf_index - 2 ? s->insert_index : s->in_buf_index - 2;
+        for (int i = c->dictionary_insert; i < end; i++) {
+            int h = hash_3(s->window + i, s->hash_bits);
+            s->head[h] = c->dictionary_tables[h];
+        }
+    }
+    s->insert_index = c->dictionary_insert;
+    s->skip_chunks = 0;
+}
+
+// compresses window positions start to end as the whole output, and catches the error which stops it.
+// the jump point is in its own function, so no local of the caller lives across it
+static int compress_message(int start, size_t end, struct state *s) {
+    int exception = setjmp(s->except);
+    if (exception == 0) {
+        compress_buffer(start, end, true, s);
+    }
+    return exception;
+}
+
+int compressor_context_compress(struct compressor_context *c, const void *in, size_t in_len,
+                                void *out, size_t out_cap, size_t *out_len) {
+    struct state *s = &c->s;
+    int start = c->dictionary_len;
+    *out_len = 0;
+    if (start > 0 && load_message(c, in, in_len) != 0) {
+        return ERR_NO_MEMORY;
+    }
+    s->dry = false;
+    s->bit_buf = 0;
+    s->bit_count = 0;
+    s->out = out;
+    s->out_len = 0;
+    s->out_cap = out_cap;
+    s->in_buf = NULL;
+    s->window = start > 0 ? c->buf : in;
+    s->in_buf_index = 0;
+    int exception = compress_message(start, start + in_len, s);
+    if (exception == 0) {
+        *out_len = s->out_len;
+    }
+    // the hash chains are cleared while the input is still there, even if it didn't fit
+    if (start == 0) {
+        clear_hashes(in, s);
+    } else {
+        restore_hashes(c);
+    }
+    return exception;
+}
+
+// Parallel compression
+// The input is cut into PARALLEL_CHUNK byte chunks, which are compressed separately. A chunk can still repeat
+// the WINDOW_SIZE bytes before it, and ends with an empty non-compressed block, so the outputs put together
+// are a single deflate stream.
+#define PARALLEL_CHUNK 131072
+
+struct parallel_job {
+    const unsigned char *in;
+    size_t in_len;
+    int level;
+    size_t chunks;           // number of chunks
+    size_t next_chunk;       // the next chunk which no thread took yet
+    pthread_mutex_t lock;    // protects next_chunk
+    unsigned char **outs;    // output of every chunk
+    size_t *out_lens;        // length of the output of every chunk
+    int *results;            // 0, or the error of every chunk
+};
+
+// compresses chunk k of the job with the state, whose tables are in TABLE_ENTRIES(MAX_WINDOW_BITS) entries
+static int compress_chunk(struct parallel_job *job, size_t k, uint16_t *tables, struct state *s) {
+    int exception = setjmp(s->except);
+    if (exception != 0) {
+        free_matcher(s);
+        return exception;
+    }
+    size_t start = k * PARALLEL_CHUNK;
+    size_t len = job->in_len - start < PARALLEL_CHUNK ? job->in_len - start : PARALLEL_CHUNK;
+    int dictionary = start < WINDOW_SIZE ? start : WINDOW_SIZE;
+    s->dry = false;
+    s->bit_buf = 0;
+    s->bit_count = 0;
+    s->out_cap = deflate_compress_bound(len) + 5;
+    s->out = malloc(s->out_cap);
+    s->out_len = 0;
+    s->in_buf = NULL;
+    s->window = job->in + start - dictionary;
+    s->in_buf_index = 0;
+    job->outs[k] = s->out;
+    if (s->out == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    init_matcher(job->level, MAX_WINDOW_BITS, tables, s);
+    compress_buffer(dictionary, dictionary + len, k == job->chunks - 1, s);
+    free_matcher(s);
+    job->out_lens[k] = s->out_len;
+    return 0;
+}
+
+static void *parallel_worker(void *arg) {
+    struct parallel_job *job = arg;
+    struct state *s = malloc(sizeof(struct state));
+    uint16_t *tables = malloc(TABLE_ENTRIES(MAX_WINDOW_BITS) * sizeof(uint16_t));
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t k = job->next_chunk++;
+        pthread_mutex_unlock(&job->lock);
+        if (k >= job->chunks) {
+            break;
+        }
+        job->results[k] = s == NULL || tables == NULL ? ERR_NO_MEMORY : compress_chunk(job, k, tables, s);
+    }
+    free(s);
+    free(tables);
+    return NULL;
+}
+
+int deflate_compress_parallel(const void *in, size_t in_len, void *out, size_t out_cap, size_t *out_len,
+                              int level, int threads) {
+    struct parallel_job job;
+    job.in = in;
+    job.in_len = in_len;
+    job.level = level;
+    // empty input is still a chunk, which writes the final block
+    job.chunks = in_len == 0 ? 1 : (in_len + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    job.next_chunk = 0;
+    job.outs = calloc(job.chunks, sizeof(unsigned char *));
+    job.out_lens = calloc(job.chunks, sizeof(size_t));
+    job.results = calloc(job.chunks, sizeof(int));
+    *out_len = 0;
+    int result = 0;
+    if (job.outs == NULL || job.out_lens == NULL || job.results == NULL) {
+        result = ERR_NO_MEMORY;
+        goto cleanup;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+
+    // this thread works too
+    if (threads < 1) threads = 1;
+    if ((size_t)threads > job.chunks) threads = job.chunks;
+    pthread_t *workers = malloc((threads - 1) * sizeof(pthread_t));
+    int started = 0;
+    while (workers != NULL && started < threads - 1 &&
+           pthread_create(&workers[started], NULL, parallel_worker, &job) == 0) {
+        started++;
+    }
+    parallel_worker(&job);
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+
+    // put the outputs together
+    for (size_t k = 0; k < job.chunks && result == 0; k++) {
+        if (job.results[k] != 0) {
+            result = job.results[k];
+        } else if (job.out_lens[k] > out_cap - *out_len) {
+            result = ERR_OUTPUT_TOO_SMALL;
+        } else {
+            memcpy((unsigned char *)out + *out_len, job.outs[k], job.out_lens[k]);
+            *out_len += job.out_lens[k];
+        }
+    }
+
+cleanup:
+    for (size_t k = 0; job.outs != NULL && k < job.chunks; k++) {
+        free(job.outs[k]);
+    }
+    free(job.outs);
+    free(job.out_lens);
+    free(job.results);
+    return result;
+}
@@ -4,4 +4,132 @@
 // Compresses from src to dest
 // Returns 0 if successful, otherwise an error code
 int compressor(FILE *dest, FILE *src);
+
+// Compresses from src to dest, at a level from 1 (fastest) to MAX_LEVEL (smallest output)
+// Levels 1-3 take the first repetition they find, and 4-9 check if the next position has a longer one.
+// Levels 10-12 keep several repetitions of every position, and choose between them by the bits the whole
+// block would take, which is a lot slower.
+// Higher levels look at more earlier positions for every repetition
+// Returns 0 if successful, otherwise an error code
+#define DEFAULT_LEVEL 6
+#define MAX_LEVEL 12
+int compressor_ex(FILE *dest, FILE *src, int level);
+
+// Compresses from src to a sink, at a level from 1 to MAX_LEVEL
+// format is FORMAT_RAW, FORMAT_ZLIB or FORMAT_GZIP
+// Returns 0 if successful, otherwise an error code
+int compressor_sink(const struct deflate_sink *dest, FILE *src, int level, int format);
+
+// Like compressor_sink, with a preset dictionary which repetitions can reach into, or NULL
+// The zlib header says which dictionary it was. gzip has no dictionaries, so it's not used for gzip
+int compressor_sink_dict(const struct deflate_sink *dest, FILE *src, int level, int format,
+                         const void *dict, size_t dict_len);
+
+// Compresses the file src to the file dest, or stdin or stdout if they are NULL, at a level from 1 to MAX_LEVEL
+// format is FORMAT_RAW, FORMAT_ZLIB or FORMAT_GZIP
+// A regular file is mapped instead of read, and a regular file dest is made as long as the output can be,
+// mapped, written in place and cut to length. Anything else, like a pipe, is compressed as a stream
+// Returns 0 if successful, otherwise an error code
+int deflate_compress_file(const char *dest, const char *src, int level, int format);
+
+// Compresses in_len bytes from in into out, which has room for out_cap bytes
+// Works straight on the input buffer, without allocating. Its hash chains, DEFLATE_COMPRESS_WORKSPACE_SIZE
+// bytes, go on the stack, which is more than some threads have
+// Sets out_len to the number of bytes written
+// Returns 0 if successful, ERR_OUTPUT_TOO_SMALL if the output doesn't fit, otherwise an error code
+#define DEFLATE_COMPRESS_WORKSPACE_SIZE (256 * 1024)
+int deflate_compress_buffer(const void *in, size_t in_len, void *out, size_t out_cap, size_t *out_len);
+
+// Like deflate_compress_buffer, with the hash chains in workspace, DEFLATE_COMPRESS_WORKSPACE_SIZE bytes
+// aligned for uint16_t, for example from malloc, instead of on the stack
+int deflate_compress_buffer_workspace(const void *in, size_t in_len, void *out, size_t out_cap, size_t *out_len,
+                                      void *workspace);
+
+// The number of bytes deflate_compress_buffer would write for in_len bytes of input, without writing anything
+// Like deflate_compress_buffer, it needs DEFLATE_COMPRESS_WORKSPACE_SIZE bytes of stack
+size_t deflate_compress_size(const void *in, size_t in_len);
+
+// Compresses like deflate_compress_buffer at a level from 1 to MAX_LEVEL, on threads threads
+// The input is compressed in 128K chunks, which can repeat the 32K before them, so the output is
+// a little bigger than from a single thread
+// Returns 0 if successful, ERR_OUTPUT_TOO_SMALL if the output doesn't fit, otherwise an error code
+int deflate_compress_parallel(const void *in, size_t in_len, void *out, size_t out_cap, size_t *out_len,
+                              int level, int threads);
+
+// Streaming compression
+// A stream takes input as it arrives, and writes blocks as soon as a window of it is full, so it uses
+// the same memory for any length of input.
+#define COMPRESS_DONE         0  // the final block was written and given to the caller
+#define COMPRESS_NEED_INPUT  -1  // all of the input was used, call again with more
+#define COMPRESS_NEED_OUTPUT -2  // the output is full, call again with more room
+
+#define COMPRESS_NO_FLUSH   0 // keep input which doesn't fill a window for later
+#define COMPRESS_SYNC_FLUSH 1 // compress all of the input so far, and end the output on a byte boundary
+#define COMPRESS_FINISH     2 // the input is over, write the final block
+
+struct compressor_stream;
+
+// Allocates a stream which compresses at a level from 1 to MAX_LEVEL
+// Returns NULL if allocating failed
+struct compressor_stream *compressor_stream_new(int level);
+
+void compressor_stream_free(struct compressor_stream *c);
+
+// Puts a preset dictionary before the input of a stream, which isn't given any input yet, so repetitions can
+// reach into it. It isn't part of the output. Only the last 32K matter
+void compressor_stream_set_dictionary(struct compressor_stream *c, const void *dict, size_t len);
+
+#ifdef DEFLATE_STATS
+// Counts what the stream does into stats from now on, or nothing if stats is NULL. see stats.h
+void compressor_stream_set_stats(struct compressor_stream *c, struct deflate_stats *stats);
+#endif
+
+// Compresses as much of in as possible into out
+// Sets in_used to the number of input bytes used, which the stream copied, and out_len to the
+// number of bytes written to out. flush is COMPRESS_NO_FLUSH, COMPRESS_SYNC_FLUSH or COMPRESS_FINISH
+// Returns COMPRESS_DONE, COMPRESS_NEED_INPUT, COMPRESS_NEED_OUTPUT or an error code
+int compressor_stream_run(struct compressor_stream *c, const void *in, size_t in_len, size_t *in_used,
+                          void *out, size_t out_cap, size_t *out_len, int flush);
+
+// Reusable compression
+// A context is made once and then compresses any number of buffers, like deflate_compress_buffer, which
+// suits many small messages: it doesn't allocate anything (except to copy messages after a dictionary),
+// and after a small message it only clears the parts of its tables the message used. Its memory is sized
+// to its window, and a repetition reaches back at most 1 << window_bits bytes, from MIN_WINDOW_BITS to
+// MAX_WINDOW_BITS.
+#define MIN_WINDOW_BITS 9
+#define MAX_WINDOW_BITS 15
+
+struct compressor_context;
+
+// Allocates a context which compresses at a level from 1 to MAX_LEVEL
+// Returns NULL if allocating failed
+struct compressor_context *compressor_context_new(int level, int window_bits);
+
+void compressor_context_free(struct compressor_context *c);
+
+// Makes every message after this start with a preset dictionary, which repetitions can reach into, or
+// none if dict is NULL. Only the last 1 << window_bits bytes matter. The dictionary is added to the hash
+// chains once, and every message starts from a copy of them
+// Returns 0 if successful, otherwise an error code
+int compressor_context_set_dictionary(struct compressor_context *c, const void *dict, size_t len);
+
+#ifdef DEFLATE_STATS
+// Counts what the context does into stats from now on, or nothing if stats is NULL. see stats.h
+void compressor_context_set_stats(struct compressor_context *c, struct deflate_stats *stats);
+#endif
+
+// Compresses in_len bytes from in into out, which has room for out_cap bytes
+// Sets out_len to the number of bytes written
+// Returns 0 if successful, ERR_OUTPUT_TOO_SMALL if the output doesn't fit
+int compressor_context_compress(struct compressor_context *c, const void *in, size_t in_len,
+                                void *out, size_t out_cap, size_t *out_len);
+
+// The biggest output deflate_compress_buffer or compressor_context_compress can have for in_len bytes of input
+size_t deflate_compress_bound(size_t in_len);
+
+#ifdef MAKEFIXED
+// writes fixedencode.h, see makefixed.c
+void makefixed_encode(FILE *out);
+#endif
 #endif
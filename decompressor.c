@@ -1,177 +1,275 @@
 #include "decompressor.h"
-#include "huffman.h"
-
-struct state {
-    FILE *dest;
-    FILE *src;
-    int bit_buf;                  // bit buffer
-    int bit_count;                // number of bits in bit buffer
-    unsigned char out_buf[65536]; // used for repetitions
-    int out_buf_index;            // index in out_buf
-    jmp_buf except;
+#ifdef __linux__
+// not in deflate.h, because it brings in linux/fs.h, which has its own BLOCK_SIZE
+#include <linux/io_uring.h>
+#endif
+
+#define MAX_REPEAT 258 // the longest repetition deflate can encode
+#define COPY_SLOP  32  // bytes copy_repeat can write past the end of a repetition
+#define FAST_ROOM  (MAX_REPEAT + COPY_SLOP) // room decode_fast needs for any repetition
+#define RING_SIZE  (8 * DECOMPRESS_WINDOW_SIZE) // memory of the output ring, see map_ring
+#define DECOMPRESS_BLOCK_END -3 // decode stopped before a block header, because stop_at_blocks is set
+
+// what a stream is in the middle of
+enum mode {
+    MODE_HEADER,            // reading a block header
+    MODE_STORED_LENGTH,     // reading the length of a non-compressed block
+    MODE_STORED,            // copying a non-compressed block
+    MODE_TABLE_SIZES,       // reading hlit, hdist and hclen of a dynamic huffman block
+    MODE_CODE_LENGTHS_CODE, // reading the code length code of a dynamic huffman block
+    MODE_CODE_LENGTHS,      // reading the literal/length and distance code lengths
+    MODE_LITERAL,           // reading a literal/length code
+    MODE_DISTANCE,          // reading the distance code of a repetition
+    MODE_REPEAT,            // copying a repetition
+    MODE_DONE,              // the final block ended
+    MODE_ERROR              // the input isn't valid deflate
 };
 
-static int bits(struct state *s, int count) {
-    long bit_buf = s->bit_buf;
-    while (s->bit_count < count) {
-        // read 8 more bits
-        unsigned char eight_bits = 0;
-        if (fread(&eight_bits, 1, 1, s->src) != 1) {
-            // failed to read
-            longjmp(s->except, ERR_INVALID_DEFLATE);
-        }
-        bit_buf |= (long)(eight_bits) << s->bit_count;
-        s->bit_count += 8;
-    }
+static const uint16_t length_base[29] = {  // Size base for length codes 257..285
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[29] = {  // Extra bits for length codes 257..285
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[30] = {    // Offset base for distance codes 0..29
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[30] = {    // Extra bits for distance codes 0..29
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+    12, 12, 13, 13};
 
-    // remove count bits from buffer
-    s->bit_buf = (int)(bit_buf >> count);
-    s->bit_count -= count;
+static const struct huffman_alphabet litlen_alphabet  = { 256, 256, 257, 29, length_base, length_extra };
+static const struct huffman_alphabet dist_alphabet    = { 0, -1, 0, 30, dist_base, dist_extra };
+static const struct huffman_alphabet codelen_alphabet = { 19, -1, 19, 0, NULL, NULL };
 
-    // return the first count bits
-    return (int)(bit_buf & ((1L << count) - 1));
+static int fail(struct decompressor_state *d) {
+    d->mode = MODE_ERROR;
+    return ERR_INVALID_DEFLATE;
 }
 
-static void write_byte(unsigned char byte, struct state *s) {
-    fwrite(&byte, 1, 1, s->dest);
-    s->out_buf[s->out_buf_index++] = byte;
-    if (s->out_buf_index == 65536) {
-        // move everything 32768 bytes
-        memmove(s->out_buf, s->out_buf + 32768, 32768);
-        s->out_buf_index -= 32768;
-    }
+// number of bytes out_buf has room for
+static size_t room(const struct decompressor_state *d) {
+    return d->out_buf_size - d->out_buf_index;
 }
 
-static void write_repeat(int length, int distance, struct state *s) {
-    if (s->out_buf_index < distance) {
-        // this could have been a segfault! sheesh
-        longjmp(s->except, ERR_INVALID_DEFLATE);
+// makes room for more output by moving the window back, keeping DECOMPRESS_WINDOW_SIZE bytes of history
+// returns false if that's impossible: the output is the caller's buffer, or wasn't given to the caller yet
+static bool make_room(struct decompressor_state *d) {
+    if (d->ring_size != 0) {
+        // the same bytes are ring_size further on, so moving back is only changing the index
+        if (d->out_buf_index >= d->ring_size + DECOMPRESS_WINDOW_SIZE && d->out_flushed >= d->ring_size) {
+            d->out_buf_index -= d->ring_size;
+            d->out_flushed -= d->ring_size;
+        }
+        // writing a byte overwrites the one ring_size before it, which must have been given to the caller
+        size_t size = d->out_flushed + d->ring_size;
+        d->out_buf_size = size < 2 * d->ring_size ? size : 2 * d->ring_size;
+        return room(d) > 0;
     }
-    for (int i = 0; i < length; i++) {
-        write_byte(s->out_buf[s->out_buf_index - distance], s);
+    if (d->out_buf != d->window || d->out_buf_index <= DECOMPRESS_WINDOW_SIZE) {
+        return false;
     }
+    size_t move = d->out_buf_index - DECOMPRESS_WINDOW_SIZE;
+    if (d->out_flushed < move) {
+        return false;
+    }
+    memmove(d->window, d->window + move, DECOMPRESS_WINDOW_SIZE);
+    d->out_buf_index -= move;
+    d->out_flushed -= move;
+    return true;
 }
 
-static void non_compressed_block(struct state *s) {
-    // read big-endian 16 bit number for length, and then nlen (one's complement of len)
-    unsigned int block_length = be16toh(bits(s, 16));
-    unsigned int block_nlen   = be16toh(bits(s, 16));
-#ifdef DEFLATE_DEBUGGING
-    printf("non-compressed block: %u bytes\n", block_length);
-#endif
-    // TODO: check that nlen is one's complement of len
-    // read block_length bytes
-    for (unsigned int i = 0; i < block_length; i++) {
-        int byte = bits(s, 8);
-        write_byte(byte, s);
+// reads count bits into value, only if all of them are available
+static bool read_bits(struct decompressor_state *d, int count, uint32_t *value) {
+    if (!bitreader_fill(&d->in, count)) {
+        return false;
     }
+    *value = bitreader_bits(&d->in, count);
+    return true;
 }
 
-// Reads the next character according to a huffman code
-static int huffman_read_next(struct huffman *huff, struct state *s) {
-    while (huff->left || huff->right) {
-        int bit = bits(s, 1);
-        if (bit) {
-            huff = huff->right;
-        } else {
-            huff = huff->left;
+// Looks up the next code in a huffman decoding table, without consuming it
+// Input is read one byte at a time, only until the code is complete, so a stream never reads past its end
+// Returns 1 and sets entry and bits if the code is complete, 0 if more input is needed, -1 if it's invalid
+static int huffman_peek(const uint32_t *table, int table_bits, struct decompressor_state *d,
+                        uint32_t *entry, int *bits) {
+    struct bitreader *in = &d->in;
+    for (;;) {
+        // bits past bit_count are zero, so the code may be looked up before all of it was read
+        uint32_t e = table[bitreader_peek(in, table_bits)];
+        int len = HUFFMAN_BITS(e);
+        if (e & HUFFMAN_SUBTABLE) {
+            // the code is longer than table_bits, look at the next bits in the subtable
+            e = table[HUFFMAN_VALUE(e) + ((in->bit_buf >> table_bits) & ((1U << HUFFMAN_EXTRA(e)) - 1))];
+            len += HUFFMAN_BITS(e);
+        }
+        if (e & HUFFMAN_INVALID) {
+            if (in->bit_count >= MAX_CODEBITS) {
+                return -1;
+            }
+        } else if (len <= in->bit_count) {
+            *entry = e;
+            *bits = len;
+            return 1;
+        }
+        if (!bitreader_fill(in, in->bit_count + 1)) {
+            return 0;
         }
     }
-    return huff->value;
 }
 
-static void read_with_huffman(struct huffman *literal_huff, struct huffman *distnce_huff, struct state *s) {
-    int literal = huffman_read_next(literal_huff, s);
-    while (literal != 256) { // 256 is end of block
-        if (literal < 256) {
-            write_byte(literal, s);
-        } else {
-            static const short lens[29] = {  // Size base for length codes 257..285
-                3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
-            static const short lext[29] = {  // Extra bits for length codes 257..285
-                0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-                3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
-            static const short dists[30] = { // Offset base for distance codes 0..29
-                1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
-                257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-                8193, 12289, 16385, 24577};
-            static const short dext[30] = {  // Extra bits for distance codes 0..29
-                0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
-                7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-                12, 12, 13, 13};
-            int lit_extra_bits = lext[literal - 257];
-            int repeat_len = lens[literal - 257] + bits(s, lit_extra_bits);
-            // read distance code
-            int dist = huffman_read_next(distnce_huff, s);
-            int dist_extra_bits = dext[dist];
-            dist = dists[dist] + bits(s, dist_extra_bits);
-            write_repeat(repeat_len, dist, s);
-        }
-        literal = huffman_read_next(literal_huff, s);
-    }
-}
-
-static void dynamic_huffman_block(struct state *s) {
-    int hlit = 257 + bits(s, 5); // number of Literal/Length codes - 257-286
-    int hdist =  1 + bits(s, 5); // number of Distance codes - 1-32
-    int hclen =  4 + bits(s, 4); // number of Code Length codes - 4-19
-    int code_lengths_order[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-    int code_lengths[19] = {0};
-    for (int i = 0; i < hclen; i++) {
-        // read the 3-bit code length
-        code_lengths[code_lengths_order[i]] = bits(s, 3);
-    }
-    struct huffman *code_lengths_huff = huffman_construct(code_lengths, 19);
-
-    // read huffman for literal/length alphabet
-    // code length repeat codes can cross from hlit to hdist
-    int dist_and_lit_huffman_lengths[286 + 32] = {0};
-    for (int i = 0; i < hlit + hdist;) {
-        int code_length = huffman_read_next(code_lengths_huff, s);
-        if (code_length <= 15) {
-            // length code of 0-15
-            dist_and_lit_huffman_lengths[i++] = code_length;
-        } else if (code_length == 16) {
-            // copy previous 3-6 times, 2 extra bits
-            int repeat_length = 3 + bits(s, 2);
-
-            if (i == 0) {
-                // this could have been a segfault! sheesh
-                huffman_free(code_lengths_huff);
-                longjmp(s->except, ERR_INVALID_DEFLATE);
-            }
+// Decodes the next code from the bits in the bit buffer, and consumes it
+static uint32_t huffman_lookup(const uint32_t *table, int table_bits, struct bitreader *in) {
+    uint32_t entry = table[bitreader_peek(in, table_bits)];
+    if (entry & HUFFMAN_SUBTABLE) {
+        bitreader_consume(in, table_bits);
+        entry = table[HUFFMAN_VALUE(entry) + bitreader_peek(in, HUFFMAN_EXTRA(entry))];
+    }
+    bitreader_consume(in, HUFFMAN_BITS(entry));
+    return entry;
+}
 
-            int repeat_this = dist_and_lit_huffman_lengths[i - 1];
-            for (int j = 0; j < repeat_length; ++j) {
-                dist_and_lit_huffman_lengths[i++] = repeat_this;
-            }
-        } else if (code_length == 17) {
-            // repeat 0 for 3-10 times
-            int repeat_length = 3 + bits(s, 3);
-            for (int j = 0; j < repeat_length; ++j) {
-                dist_and_lit_huffman_lengths[i++] = 0;
-            }
-        } else if (code_length == 18) {
-            // repeat 0 for 11-138 times
-            int repeat_length = 11 + bits(s, 7);
-            for (int j = 0; j < repeat_length; ++j) {
-                dist_and_lit_huffman_lengths[i++] = 0;
-            }
+// Copies a repetition of length bytes from distance bytes back, in words instead of bytes.
+// Up to COPY_SLOP bytes after the repetition are overwritten, so there must be room for them.
+// A repetition at least 32 bytes back is copied 32 bytes at a time, which decode_fast_avx2 makes a single
+// AVX2 load and store, and otherwise two SSE2 ones
+static inline __attribute__((always_inline)) void copy_repeat(unsigned char *out, size_t distance, int length) {
+    const unsigned char *from = out - distance;
+    unsigned char *end = out + length;
+    if (distance == 1) {
+        // a run of the same byte
+        memset(out, from[0], length);
+        return;
+    }
+    if (distance < 8) {
+        // the repetition repeats itself every distance bytes. write 8 bytes of that pattern at a time,
+        // and move by the most whole patterns which fit in 8 bytes, so every write starts a pattern.
+        // distances 2 and 4 move by all 8 bytes
+        unsigned char pattern[8];
+        for (int i = 0; i < 8; i++) {
+            pattern[i] = from[i % distance];
+        }
+        size_t step = 8 - 8 % distance;
+        do {
+            memcpy(out, pattern, 8);
+            out += step;
+        } while (out < end);
+        return;
+    }
+    if (distance >= 32) {
+        // every 32 bytes are read after they were written, because they're at least 32 bytes back
+        do {
+            memcpy(out, from, 32);
+            out += 32;
+            from += 32;
+        } while (out < end);
+        return;
+    }
+    if (distance >= 16) {
+        do {
+            memcpy(out, from, 16);
+            out += 16;
+            from += 16;
+        } while (out < end);
+        return;
+    }
+    do {
+        memcpy(out, from, 8);
+        out += 8;
+        from += 8;
+    } while (out < end);
+}
+
+// Decodes literals and repetitions while there is plenty of input and room for output, so nothing
+// is checked or suspended in the middle of a code. It's built once for any CPU, and once for AVX2
+// Returns 0 if successful, otherwise an error code
+static inline __attribute__((always_inline)) int decode_fast_body(struct decompressor_state *d) {
+    struct bitreader *in = &d->in;
+    const unsigned char *start = in->next;
+    unsigned char *out = d->out_buf;
+    const uint32_t *literal_codes = d->literal_codes;
+    const uint32_t *distnce_codes = d->distnce_codes;
+    size_t index = d->out_buf_index;
+    int result = 0;
+    while (bitreader_avail(in) >= 8 && d->out_buf_size - index >= FAST_ROOM) {
+        // one refill leaves at least 56 bits, which is enough for a length code, a distance code and
+        // both of their extra bits
+        bitreader_refill_fast(in);
+        uint32_t entry = huffman_lookup(literal_codes, HUFFMAN_LITLEN_BITS, in);
+        if (entry & HUFFMAN_LITERAL) {
+            out[index++] = HUFFMAN_VALUE(entry);
+            STATS(d->stats, d->stats->literals += 1);
+            continue;
+        } else if (entry & HUFFMAN_END) {
+            d->mode = d->last ? MODE_DONE : MODE_HEADER;
+            break;
+        } else if (entry & HUFFMAN_INVALID) {
+            result = fail(d);
+            break;
+        }
+        int length = HUFFMAN_VALUE(entry) + bitreader_bits(in, HUFFMAN_EXTRA(entry));
+        entry = huffman_lookup(distnce_codes, HUFFMAN_DIST_BITS, in);
+        size_t distance = HUFFMAN_VALUE(entry) + bitreader_bits(in, HUFFMAN_EXTRA(entry));
+        if ((entry & HUFFMAN_INVALID) || distance > index) {
+            // this could have been a segfault! sheesh
+            result = fail(d);
+            break;
         }
+        copy_repeat(out + index, distance, length);
+        STATS(d->stats, stats_match(d->stats, length, distance));
+        index += length;
     }
-    huffman_free(code_lengths_huff);
-    // construct literal and distance huffman codes
-    struct huffman *literal_huff = huffman_construct(dist_and_lit_huffman_lengths, hlit);
-    struct huffman *distnce_huff = huffman_construct(dist_and_lit_huffman_lengths + hlit, hdist);
-    read_with_huffman(literal_huff, distnce_huff, s);
-    // free unused stuff
-    huffman_free(literal_huff);
-    huffman_free(distnce_huff);
+    d->out_buf_index = index;
+
+    // give back the whole bytes which were read ahead, so the input ends right after the last code
+    size_t extra = in->bit_count >> 3;
+    if (extra > (size_t)(in->next - start)) {
+        extra = in->next - start;
+    }
+    in->next -= extra;
+    in->bit_count -= extra * 8;
+    in->bit_buf &= ((uint64_t)1 << in->bit_count) - 1;
+    return result;
 }
 
-static void fixed_huffman_block(struct state *s) {
-    // construct huffman
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2
+
+__attribute__((target("avx2")))
+static int decode_fast_avx2(struct decompressor_state *d) {
+    return decode_fast_body(d);
+}
+#endif
+
+static bool has_avx2 = false;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+static void cpu_init(void) {
+#ifdef HAVE_AVX2
+    __builtin_cpu_init();
+    has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+static int decode_fast(struct decompressor_state *d) {
+#ifdef HAVE_AVX2
+    if (has_avx2) {
+        return decode_fast_avx2(d);
+    }
+#endif
+    return decode_fast_body(d);
+}
+
+#ifdef MAKEFIXED
+static uint32_t fixed_literal_table[HUFFMAN_LITLEN_ENOUGH];
+static uint32_t fixed_distnce_table[HUFFMAN_DIST_ENOUGH];
+static int fixed_literal_used;
+static int fixed_distnce_used;
+
+// builds the fixed huffman tables, which are otherwise in fixeddecode.h
+static void fixed_tables(void) {
     int lengths[288];
     int i;
     for (i = 0; i < 144; ++i) {
@@ -186,60 +284,1223 @@ static void fixed_huffman_block(struct state *s) {
     for (; i < 288; ++i) {
         lengths[i] = 8;
     }
-    struct huffman *literal_huff = huffman_construct(lengths, 288);
-    for (i = 0; i < 30; ++i) {
+    fixed_literal_used = huffman_table_build(fixed_literal_table, HUFFMAN_LITLEN_BITS, HUFFMAN_LITLEN_ENOUGH,
+                                             lengths, 288, &litlen_alphabet);
+    // distance codes 30 and 31 are part of the code, but are invalid
+    for (i = 0; i < 32; ++i) {
         lengths[i] = 5;
     }
-    struct huffman *distnce_huff = huffman_construct(lengths, 30);
-    // read as usual
-    read_with_huffman(literal_huff, distnce_huff, s);
-    huffman_free(literal_huff);
-    huffman_free(distnce_huff);
+    fixed_distnce_used = huffman_table_build(fixed_distnce_table, HUFFMAN_DIST_BITS, HUFFMAN_DIST_ENOUGH,
+                                             lengths, 32, &dist_alphabet);
 }
 
-int decompressor(FILE *dest, FILE *src) {
-    struct state s;
-    s.src = src;
-    s.dest = dest;
-    s.bit_buf = 0;
-    s.bit_count = 0;
-    s.out_buf_index = 0;
-    
-    int exception = setjmp(s.except);
-    if (exception != 0) {
-        return exception;
+static void print_table(FILE *out, const char *name, const uint32_t *table, int size) {
+    fprintf(out, "static const uint32_t %s[%d] = {", name, size);
+    for (int i = 0; i < size; i++) {
+        fprintf(out, "%s0x%08x,", i % 6 ? " " : "\n    ", table[i]);
+    }
+    fprintf(out, "\n};\n");
+}
+
+void makefixed_decode(FILE *out) {
+    fixed_tables();
+    fprintf(out, "// fixeddecode.h -- fixed huffman decoding tables for decompressor.c\n");
+    fprintf(out, "// generated by makefixed.c, don't edit\n\n");
+    print_table(out, "fixed_literal_table", fixed_literal_table, fixed_literal_used);
+    fprintf(out, "\n");
+    print_table(out, "fixed_distnce_table", fixed_distnce_table, fixed_distnce_used);
+}
+#else
+#include "fixeddecode.h"
+#endif
+
+// builds a table for the current block after the ones already in the arena
+// returns the table, or NULL if the lengths are not a valid code
+static const uint32_t *arena_table(struct decompressor_state *d, int table_bits, const int *lengths, int count,
+                                   const struct huffman_alphabet *alphabet) {
+    uint32_t *table = d->arena + d->arena_used;
+    int used = huffman_table_build(table, table_bits, DECOMPRESS_ARENA_SIZE - d->arena_used,
+                                   lengths, count, alphabet);
+    if (used < 0) {
+        return NULL;
+    }
+    d->arena_used += used;
+    return table;
+}
+
+#ifdef DEFLATE_STATS
+// whether the stream is reading a block header, rather than the data of a block
+static bool in_header(const struct decompressor_state *d) {
+    return d->mode == MODE_HEADER || d->mode == MODE_STORED_LENGTH || d->mode == MODE_TABLE_SIZES ||
+           d->mode == MODE_CODE_LENGTHS_CODE || d->mode == MODE_CODE_LENGTHS;
+}
+
+// adds the time since the last call to header_ns or symbols_ns, for what the stream was doing
+static void stats_time(struct decompressor_state *d) {
+    uint64_t now = stats_clock();
+    if (d->stats_header) {
+        d->stats->header_ns += now - d->stats_since;
     } else {
-        // decompress block by block
-        int is_last = 0;
-        // first bit - whether this is the final block
-        while (is_last == 0) {
-            is_last = bits(&s, 1);
-            // next 2 bits - whether this block is non-compressed, fixed huffman or dynamic huffman
-            int block_type = bits(&s, 2);
-            switch (block_type) {
-                case 0b00:
-                    // non-compressed
-                    non_compressed_block(&s);
-                    break;
-                case 0b01:
-                    // fixed huffman
+        d->stats->symbols_ns += now - d->stats_since;
+    }
+    d->stats_since = now;
+    d->stats_header = in_header(d);
+}
+#endif
+
+// Decodes until more input or room for output is needed, or the stream ends
+// Returns DECOMPRESS_DONE, DECOMPRESS_NEED_INPUT, DECOMPRESS_NEED_OUTPUT or an error code
+static int decode_blocks(struct decompressor_state *d) {
+    struct bitreader *in = &d->in;
+    uint32_t value;
+    uint32_t entry;
+    int bits;
+    int found;
+    for (;;) {
+#ifdef DEFLATE_STATS
+        // the clock is only read when the stream goes between headers and data
+        if (d->stats != NULL && d->stats_header != in_header(d)) {
+            stats_time(d);
+        }
+#endif
+        switch (d->mode) {
+            case MODE_HEADER:
+                if (d->stop_at_blocks && !d->stopped) {
+                    d->stopped = true;
+                    return DECOMPRESS_BLOCK_END;
+                }
+                // first bit - whether this is the final block
+                // next 2 bits - whether this block is non-compressed, fixed huffman or dynamic huffman
+                if (!read_bits(d, 3, &value)) {
+                    return DECOMPRESS_NEED_INPUT;
+                }
+                d->stopped = false;
+                d->last = value & 1;
+                switch (value >> 1) {
+                    case 0b00:
+                        // non-compressed
+                        STATS(d->stats, d->stats->stored_blocks += 1);
+                        d->mode = MODE_STORED_LENGTH;
+                        break;
+                    case 0b01:
+                        // fixed huffman
 #ifdef DEFLATE_DEBUGGING
-                    printf("fixed huffman block\n");
+                        printf("fixed huffman block\n");
 #endif
-                    fixed_huffman_block(&s);
-                    break;
-                case 0b10:
-                    // dynamic huffman
+#ifdef MAKEFIXED
+                        fixed_tables();
+#endif
+                        STATS(d->stats, d->stats->fixed_blocks += 1);
+                        d->literal_codes = fixed_literal_table;
+                        d->distnce_codes = fixed_distnce_table;
+                        d->mode = MODE_LITERAL;
+                        break;
+                    case 0b10:
+                        // dynamic huffman
+#ifdef DEFLATE_DEBUGGING
+                        printf("dynamic huffman block\n");
+#endif
+                        STATS(d->stats, d->stats->dynamic_blocks += 1);
+                        d->mode = MODE_TABLE_SIZES;
+                        break;
+                    default:
+                        // invalid!
+                        return fail(d);
+                }
+                break;
+
+            case MODE_STORED_LENGTH:
+                // skip to a byte boundary, then read the 16 bit length and nlen (one's complement of len)
+                bitreader_align(in);
+                if (!read_bits(d, 32, &value)) {
+                    return DECOMPRESS_NEED_INPUT;
+                }
+                d->length = value & 0xffff;
+                if (d->length != (int)(~value >> 16)) {
+                    return fail(d);
+                }
 #ifdef DEFLATE_DEBUGGING
-                    printf("dynamic huffman block\n");
+                printf("non-compressed block: %d bytes\n", d->length);
 #endif
-                    dynamic_huffman_block(&s);
+                d->mode = MODE_STORED;
+                break;
+
+            case MODE_STORED:
+                // copy the block, in spans as big as the input and out_buf allow
+                while (d->length > 0) {
+                    if (room(d) == 0 && !make_room(d)) {
+                        return DECOMPRESS_NEED_OUTPUT;
+                    }
+                    size_t span = room(d);
+                    if (span > (size_t)d->length) {
+                        span = d->length;
+                    }
+                    size_t copied = bitreader_copy(in, d->out_buf + d->out_buf_index, span);
+                    if (copied == 0) {
+                        return DECOMPRESS_NEED_INPUT;
+                    }
+                    d->out_buf_index += copied;
+                    d->length -= copied;
+                    STATS(d->stats, d->stats->stored_bytes += copied);
+                }
+                d->mode = d->last ? MODE_DONE : MODE_HEADER;
+                break;
+
+            case MODE_TABLE_SIZES:
+                if (!read_bits(d, 14, &value)) {
+                    return DECOMPRESS_NEED_INPUT;
+                }
+                d->hlit = 257 + (value & 31);        // number of Literal/Length codes - 257-286
+                d->hdist =  1 + ((value >> 5) & 31); // number of Distance codes - 1-32
+                d->hclen =  4 + (value >> 10);       // number of Code Length codes - 4-19
+                if (d->hlit > 286 || d->hdist > 30) {
+                    return fail(d);
+                }
+                d->lengths_read = 0;
+                d->mode = MODE_CODE_LENGTHS_CODE;
+                break;
+
+            case MODE_CODE_LENGTHS_CODE: {
+                static const int code_lengths_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+                while (d->lengths_read < d->hclen) {
+                    // read the 3-bit code length
+                    if (!read_bits(d, 3, &value)) {
+                        return DECOMPRESS_NEED_INPUT;
+                    }
+                    d->lengths[code_lengths_order[d->lengths_read++]] = value;
+                }
+                for (; d->lengths_read < 19; d->lengths_read++) {
+                    d->lengths[code_lengths_order[d->lengths_read]] = 0;
+                }
+                d->arena_used = 0;
+                if (arena_table(d, HUFFMAN_CODELEN_BITS, d->lengths, 19, &codelen_alphabet) == NULL) {
+                    return fail(d);
+                }
+                d->lengths_read = 0;
+                d->mode = MODE_CODE_LENGTHS;
+                break;
+            }
+
+            case MODE_CODE_LENGTHS:
+                // read huffman for literal/length alphabet
+                // code length repeat codes can cross from hlit to hdist
+                while (d->lengths_read < d->hlit + d->hdist) {
+                    found = huffman_peek(d->arena, HUFFMAN_CODELEN_BITS, d, &entry, &bits);
+                    if (found <= 0) {
+                        return found == 0 ? DECOMPRESS_NEED_INPUT : fail(d);
+                    }
+                    int code_length = HUFFMAN_VALUE(entry);
+                    if (code_length <= 15) {
+                        // length code of 0-15
+                        bitreader_consume(in, bits);
+                        d->lengths[d->lengths_read++] = code_length;
+                        continue;
+                    }
+                    // 16 copies the previous length 3-6 times, 17 repeats 0 for 3-10 times,
+                    // and 18 repeats 0 for 11-138 times. the code and its extra bits are read together
+                    static const int repeat_bits[3] = {2, 3, 7};
+                    static const int repeat_min[3] = {3, 3, 11};
+                    int extra = repeat_bits[code_length - 16];
+                    if (!bitreader_fill(in, bits + extra)) {
+                        return DECOMPRESS_NEED_INPUT;
+                    }
+                    bitreader_consume(in, bits);
+                    int repeat_length = repeat_min[code_length - 16] + bitreader_bits(in, extra);
+                    int repeat_this = 0;
+                    if (code_length == 16) {
+                        if (d->lengths_read == 0) {
+                            // this could have been a segfault! sheesh
+                            return fail(d);
+                        }
+                        repeat_this = d->lengths[d->lengths_read - 1];
+                    }
+                    if (d->lengths_read + repeat_length > d->hlit + d->hdist) {
+                        return fail(d);
+                    }
+                    for (int j = 0; j < repeat_length; ++j) {
+                        d->lengths[d->lengths_read++] = repeat_this;
+                    }
+                }
+                // construct literal and distance decoding tables. there must be an end of block code
+                // they go over the code length table, which isn't needed anymore
+                if (d->lengths[256] == 0) {
+                    return fail(d);
+                }
+                d->arena_used = 0;
+                d->literal_codes = arena_table(d, HUFFMAN_LITLEN_BITS, d->lengths, d->hlit, &litlen_alphabet);
+                d->distnce_codes = arena_table(d, HUFFMAN_DIST_BITS, d->lengths + d->hlit, d->hdist, &dist_alphabet);
+                if (d->literal_codes == NULL || d->distnce_codes == NULL) {
+                    return fail(d);
+                }
+                d->mode = MODE_LITERAL;
+                break;
+
+            case MODE_LITERAL:
+                if (room(d) < FAST_ROOM) {
+                    make_room(d);
+                }
+                if (bitreader_avail(in) >= 8 && room(d) >= FAST_ROOM) {
+                    if (decode_fast(d) != 0) {
+                        return ERR_INVALID_DEFLATE;
+                    }
                     break;
-                default:
-                    // invalid!
-                    return 1;
+                }
+                found = huffman_peek(d->literal_codes, HUFFMAN_LITLEN_BITS, d, &entry, &bits);
+                if (found <= 0) {
+                    return found == 0 ? DECOMPRESS_NEED_INPUT : fail(d);
+                }
+                if (entry & HUFFMAN_LITERAL) {
+                    if (room(d) == 0) {
+                        return DECOMPRESS_NEED_OUTPUT;
+                    }
+                    bitreader_consume(in, bits);
+                    d->out_buf[d->out_buf_index++] = HUFFMAN_VALUE(entry);
+                    STATS(d->stats, d->stats->literals += 1);
+                } else if (entry & HUFFMAN_END) {
+                    bitreader_consume(in, bits);
+                    d->mode = d->last ? MODE_DONE : MODE_HEADER;
+                } else {
+                    // the length code and its extra bits are read together
+                    if (!bitreader_fill(in, bits + HUFFMAN_EXTRA(entry))) {
+                        return DECOMPRESS_NEED_INPUT;
+                    }
+                    bitreader_consume(in, bits);
+                    d->length = HUFFMAN_VALUE(entry) + bitreader_bits(in, HUFFMAN_EXTRA(entry));
+                    d->mode = MODE_DISTANCE;
+                }
+                break;
+
+            case MODE_DISTANCE:
+                found = huffman_peek(d->distnce_codes, HUFFMAN_DIST_BITS, d, &entry, &bits);
+                if (found <= 0) {
+                    return found == 0 ? DECOMPRESS_NEED_INPUT : fail(d);
+                }
+                if (!bitreader_fill(in, bits + HUFFMAN_EXTRA(entry))) {
+                    return DECOMPRESS_NEED_INPUT;
+                }
+                bitreader_consume(in, bits);
+                d->distance = HUFFMAN_VALUE(entry) + bitreader_bits(in, HUFFMAN_EXTRA(entry));
+                if ((size_t)d->distance > d->out_buf_index) {
+                    // this could have been a segfault! sheesh
+                    return fail(d);
+                }
+                STATS(d->stats, stats_match(d->stats, d->length, d->distance));
+                d->mode = MODE_REPEAT;
+                break;
+
+            case MODE_REPEAT:
+                while (d->length > 0) {
+                    if (room(d) == 0 && !make_room(d)) {
+                        return DECOMPRESS_NEED_OUTPUT;
+                    }
+                    size_t span = room(d);
+                    if (span > (size_t)d->length) {
+                        span = d->length;
+                    }
+                    unsigned char *out = d->out_buf + d->out_buf_index;
+                    const unsigned char *from = out - d->distance;
+                    for (size_t i = 0; i < span; i++) {
+                        out[i] = from[i];
+                    }
+                    d->out_buf_index += span;
+                    d->length -= span;
+                }
+                d->mode = MODE_LITERAL;
+                break;
+
+            case MODE_DONE:
+                return DECOMPRESS_DONE;
+
+            default:
+                return ERR_INVALID_DEFLATE;
+        }
+    }
+}
+
+// decode_blocks, counted into the stream's stats if it has them
+static int decode(struct decompressor_state *d) {
+#ifdef DEFLATE_STATS
+    if (d->stats != NULL) {
+        const unsigned char *next = d->in.next;
+        int bit_count = d->in.bit_count;
+        d->stats_since = stats_clock();
+        d->stats_header = in_header(d);
+        int result = decode_blocks(d);
+        stats_time(d);
+        d->stats->in_bits += (d->in.next - next) * 8 - (d->in.bit_count - bit_count);
+        return result;
+    }
+#endif
+    return decode_blocks(d);
+}
+
+#ifdef DEFLATE_STATS
+void decompressor_stream_set_stats(struct decompressor_stream *stream, struct deflate_stats *stats) {
+    stream->state.stats = stats;
+}
+#endif
+
+// prepares d for decompressing into window, which is 2 * DECOMPRESS_WINDOW_SIZE bytes, or NULL if the
+// caller sets out_buf to the whole output
+static void init_state(struct decompressor_state *d, unsigned char *window) {
+    pthread_once(&cpu_once, cpu_init);
+    d->mode = MODE_HEADER;
+    d->last = false;
+    bitreader_init(&d->in, NULL, 0);
+    d->window = window;
+    d->out_buf = window;
+    d->out_buf_index = 0;
+    d->out_buf_size = window != NULL ? 2 * DECOMPRESS_WINDOW_SIZE : 0;
+    d->out_flushed = 0;
+    d->ring_size = 0;
+    d->stop_at_blocks = false;
+    d->stopped = false;
+    d->literal_codes = d->arena;
+    d->distnce_codes = d->arena;
+    d->arena_used = 0;
+#ifdef DEFLATE_STATS
+    d->stats = NULL;
+#endif
+}
+
+void decompressor_stream_init(struct decompressor_stream *stream) {
+    init_state(&stream->state, stream->window);
+}
+
+static void set_dictionary(struct decompressor_state *d, const void *dict, size_t len) {
+    if (len > DECOMPRESS_WINDOW_SIZE) {
+        dict = (const unsigned char *)dict + len - DECOMPRESS_WINDOW_SIZE;
+        len = DECOMPRESS_WINDOW_SIZE;
+    }
+    // it's already given to the caller, as far as the output goes
+    memcpy(d->out_buf + d->out_buf_index, dict, len);
+    d->out_buf_index += len;
+    d->out_flushed = d->out_buf_index;
+}
+
+void decompressor_stream_set_dictionary(struct decompressor_stream *stream, const void *dict, size_t len) {
+    set_dictionary(&stream->state, dict, len);
+}
+
+int decompressor_stream_run(struct decompressor_stream *stream, const void *in, size_t in_len, size_t *in_used,
+                            void *out, size_t out_cap, size_t *out_len) {
+    struct decompressor_state *d = &stream->state;
+    d->in.next = in;
+    d->in.end = d->in.next + in_len;
+    *out_len = 0;
+    int result;
+    for (;;) {
+        result = decode(d);
+        // give the caller as much of the new output as fits
+        size_t pending = d->out_buf_index - d->out_flushed;
+        if (pending > out_cap - *out_len) {
+            pending = out_cap - *out_len;
+        }
+        memcpy((unsigned char *)out + *out_len, d->window + d->out_flushed, pending);
+        *out_len += pending;
+        d->out_flushed += pending;
+        // when the window was full, it can move now, unless the caller's output is full too
+        if (result != DECOMPRESS_NEED_OUTPUT || *out_len == out_cap) {
+            break;
+        }
+    }
+    if (result <= DECOMPRESS_DONE && d->out_flushed != d->out_buf_index) {
+        // there is output left which didn't fit
+        result = DECOMPRESS_NEED_OUTPUT;
+    }
+    *in_used = d->in.next - (const unsigned char *)in;
+    return result;
+}
+
+// Maps size bytes of memory twice in a row, so writing past the end of the first mapping writes to the
+// start of it, and any span of up to size bytes is contiguous
+// Returns NULL if the system can't
+static unsigned char *map_ring(size_t size) {
+#ifdef SYS_memfd_create
+    int fd = syscall(SYS_memfd_create, "deflate-window", 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    unsigned char *ring = NULL;
+    if (ftruncate(fd, size) == 0) {
+        // reserve both halves together, then map the same memory over each of them
+        ring = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            ring = NULL;
+        } else if (mmap(ring, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+                   mmap(ring + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(ring, 2 * size);
+            ring = NULL;
+        }
+    }
+    close(fd);
+    return ring;
+#else
+    (void)size;
+    return NULL;
+#endif
+}
+
+int decompressor(FILE *dest, FILE *src) {
+    struct deflate_sink sink = deflate_sink_file(dest);
+    return decompressor_sink(&sink, src, FORMAT_RAW);
+}
+
+struct batch_reader;
+static bool batch_read(struct batch_reader *reader, const unsigned char **data, size_t *len);
+
+// input of decompressor_sink, read from a FILE into the stream's bit reader
+struct file_input {
+    FILE *src;                   // NULL if the bit reader has all of the input, from a mapping, or reader reads it
+    struct batch_reader *reader; // reads ahead for a batch worker, or NULL
+    uint32_t header_crc;         // CRC-32 of the bytes consumed since a gzip header started
+    unsigned char buf[16384];
+};
+
+// returns false if the file ended
+static bool refill_input(struct decompressor_state *d, struct file_input *input) {
+    if (input->reader != NULL) {
+        size_t len;
+        if (!batch_read(input->reader, &d->in.next, &len)) {
+            return false;
+        }
+        d->in.end = d->in.next + len;
+        return true;
+    }
+    if (input->src == NULL) {
+        return false;
+    }
+    size_t len = fread(input->buf, 1, sizeof(input->buf), input->src);
+    d->in.next = input->buf;
+    d->in.end = input->buf + len;
+    return len > 0;
+}
+
+// reads the next whole byte outside of the deflate data: first from the bit buffer, then the input
+// returns -1 if the input ended
+static int input_byte(struct decompressor_state *d, struct file_input *input, bool consume) {
+    unsigned char byte;
+    if (d->in.bit_count >= 8) {
+        if (!consume) {
+            return d->in.bit_buf & 0xff;
+        }
+        byte = bitreader_bits(&d->in, 8);
+    } else {
+        if (d->in.next == d->in.end && !refill_input(d, input)) {
+            return -1;
+        }
+        if (!consume) {
+            return *d->in.next;
+        }
+        byte = *d->in.next++;
+    }
+    input->header_crc = crc32_update(input->header_crc, &byte, 1);
+    return byte;
+}
+
+// reads a little endian number of count bytes
+// returns false if the input ended
+static bool input_number(struct decompressor_state *d, struct file_input *input, int count, uint32_t *value) {
+    *value = 0;
+    for (int i = 0; i < count; i++) {
+        int byte = input_byte(d, input, true);
+        if (byte < 0) {
+            return false;
+        }
+        *value |= (uint32_t)byte << (8 * i);
+    }
+    return true;
+}
+
+// skips a zero terminated string, the file name or comment in a gzip header
+static bool skip_string(struct decompressor_state *d, struct file_input *input) {
+    int byte;
+    do {
+        byte = input_byte(d, input, true);
+    } while (byte > 0);
+    return byte == 0;
+}
+
+// reads a big endian number of bytes into value, for zlib
+static bool input_big_endian(struct decompressor_state *d, struct file_input *input, int bytes, uint32_t *value) {
+    *value = 0;
+    for (int i = 0; i < bytes; i++) {
+        int byte = input_byte(d, input, true);
+        if (byte < 0) {
+            return false;
+        }
+        *value = (*value << 8) | byte;
+    }
+    return true;
+}
+
+// reads the header before the deflate data, and puts the preset dictionary in the history if it needs one
+// Returns 0 if successful, otherwise an error code
+static int read_container_header(struct decompressor_state *d, struct file_input *input, int format,
+                                 const void *dict, size_t dict_len) {
+    uint32_t value;
+    if (format == FORMAT_ZLIB) {
+        // compression method 8 (deflate) with a window up to 32K, and a check making the 16 bits a multiple of 31
+        if (!input_number(d, input, 2, &value)) {
+            return ERR_INVALID_DEFLATE;
+        }
+        int cmf = value & 0xff, flg = value >> 8;
+        if ((cmf & 0x0f) != 8 || (cmf >> 4) > 7 || (cmf * 256 + flg) % 31 != 0) {
+            return ERR_INVALID_DEFLATE;
+        }
+        if (flg & 0x20) {
+            // a preset dictionary, which is known by its adler-32
+            if (!input_big_endian(d, input, 4, &value)) {
+                return ERR_INVALID_DEFLATE;
             }
+            if (dict == NULL || adler32_update(ADLER32_INIT, dict, dict_len) != value) {
+                return ERR_DICTIONARY;
+            }
+            set_dictionary(d, dict, dict_len);
+        }
+    } else if (format == FORMAT_GZIP) {
+        // magic, compression method 8 (deflate), flags, then time, extra flags and os, which don't matter
+        input->header_crc = CRC32_INIT;
+        if (!input_number(d, input, 4, &value) || (value & 0xffffff) != 0x088b1f) {
+            return ERR_INVALID_DEFLATE;
+        }
+        int flags = value >> 24;
+        if ((flags & 0xe0) || !input_number(d, input, 4, &value) || !input_number(d, input, 2, &value)) {
+            return ERR_INVALID_DEFLATE;
+        }
+        if (flags & 0x04) {
+            // extra field, with its length first
+            if (!input_number(d, input, 2, &value)) {
+                return ERR_INVALID_DEFLATE;
+            }
+            for (uint32_t i = 0; i < value; i++) {
+                if (input_byte(d, input, true) < 0) {
+                    return ERR_INVALID_DEFLATE;
+                }
+            }
+        }
+        if (((flags & 0x08) && !skip_string(d, input)) || ((flags & 0x10) && !skip_string(d, input))) {
+            return ERR_INVALID_DEFLATE;
+        }
+        if (flags & 0x02) {
+            // the low 16 bits of the CRC-32 of the header before it
+            uint32_t crc = input->header_crc;
+            if (!input_number(d, input, 2, &value)) {
+                return ERR_INVALID_DEFLATE;
+            }
+            if (value != (crc & 0xffff)) {
+                return ERR_BAD_CHECKSUM;
+            }
+        }
+    }
+    return 0;
+}
+
+// reads the trailer after the deflate data, and compares it to the checksum and length of the output
+// Returns 0 if successful, otherwise an error code
+static int read_container_trailer(struct decompressor_state *d, struct file_input *input, int format,
+                                  uint32_t check, uint32_t size) {
+    uint32_t value;
+    bitreader_align(&d->in);
+    if (format == FORMAT_ZLIB) {
+        // big endian, unlike everything else
+        if (!input_big_endian(d, input, 4, &value)) {
+            return ERR_INVALID_DEFLATE;
+        }
+        if (value != check) {
+            return ERR_BAD_CHECKSUM;
+        }
+    } else if (format == FORMAT_GZIP) {
+        if (!input_number(d, input, 4, &value)) {
+            return ERR_INVALID_DEFLATE;
+        }
+        uint32_t isize;
+        if (!input_number(d, input, 4, &isize)) {
+            return ERR_INVALID_DEFLATE;
+        }
+        if (value != check || isize != size) {
+            return ERR_BAD_CHECKSUM;
+        }
+    }
+    return 0;
+}
+
+int decompressor_sink(const struct deflate_sink *dest, FILE *src, int format) {
+    return decompressor_sink_dict(dest, src, format, NULL, 0);
+}
+
+// decompresses the input to a sink with stream, which is initialised here, and the output ring
+// from map_ring, or NULL. mapping is all of the input, if it isn't NULL
+static int decompress_with(struct decompressor_stream *stream, unsigned char *ring, const struct deflate_sink *dest,
+                           struct file_input *input, const struct deflate_mapping *mapping,
+                           int format, const void *dict, size_t dict_len) {
+    decompressor_stream_init(stream);
+    struct decompressor_state *d = &stream->state;
+    if (mapping != NULL) {
+        bitreader_init(&d->in, mapping->data, mapping->len);
+    }
+    // output goes to a ring when possible, so the history never moves. otherwise the window moves back
+    if (ring != NULL) {
+        d->out_buf = ring;
+        d->out_buf_size = RING_SIZE;
+        d->ring_size = RING_SIZE;
+    }
+    uint32_t check = format == FORMAT_ZLIB ? ADLER32_INIT : CRC32_INIT;
+    uint32_t size = 0; // output length of a gzip member, modulo 2^32
+    int result = read_container_header(d, input, format, dict, dict_len);
+    if (format == FORMAT_RAW && dict != NULL) {
+        set_dictionary(d, dict, dict_len);
+    }
+    while (result == 0) {
+        result = decode(d);
+        // write the new output straight from the window, in one span
+        if (d->out_buf_index > d->out_flushed) {
+            const unsigned char *span = d->out_buf + d->out_flushed;
+            size_t span_len = d->out_buf_index - d->out_flushed;
+            int error = dest->write(dest->context, span, span_len);
+            if (error != 0) {
+                result = error;
+                break;
+            }
+            if (format == FORMAT_ZLIB) {
+                check = adler32_update(check, span, span_len);
+            } else if (format == FORMAT_GZIP) {
+                check = crc32_update(check, span, span_len);
+            }
+            size += span_len;
+            d->out_flushed = d->out_buf_index;
+        }
+        if (result == DECOMPRESS_NEED_INPUT) {
+            if (!refill_input(d, input)) {
+                // the file ended before the final block
+                result = ERR_INVALID_DEFLATE;
+            } else {
+                result = 0;
+            }
+        } else if (result == DECOMPRESS_NEED_OUTPUT) {
+            result = 0;
+        } else if (result == DECOMPRESS_DONE) {
+            result = read_container_trailer(d, input, format, check, size);
+            if (result != 0 || format != FORMAT_GZIP || input_byte(d, input, false) < 0) {
+                break;
+            }
+            // another gzip member starts right after this one. it can't repeat the one before, so the
+            // history starts over, after all of it was written
+            result = read_container_header(d, input, format, NULL, 0);
+            d->mode = MODE_HEADER;
+            d->last = false;
+            d->out_buf_index = d->out_flushed = 0;
+            if (d->ring_size != 0) {
+                d->out_buf_size = d->ring_size;
+            }
+            check = CRC32_INIT;
+            size = 0;
         }
     }
+    return result;
+}
+
+// decompresses from src, or from mapping if it isn't NULL, to a sink
+static int decompress_input(const struct deflate_sink *dest, FILE *src, const struct deflate_mapping *mapping,
+                            int format, const void *dict, size_t dict_len) {
+    struct file_input input;
+    input.src = src;
+    input.reader = NULL;
+    input.header_crc = CRC32_INIT;
+    struct decompressor_stream *stream = malloc(sizeof(struct decompressor_stream));
+    if (stream == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    unsigned char *ring = map_ring(RING_SIZE);
+    int result = decompress_with(stream, ring, dest, &input, mapping, format, dict, dict_len);
+    if (ring != NULL) {
+        munmap(ring, 2 * RING_SIZE);
+    }
+    free(stream);
+    return result;
+}
+
+int decompressor_sink_dict(const struct deflate_sink *dest, FILE *src, int format, const void *dict, size_t dict_len) {
+    return decompress_input(dest, src, NULL, format, dict, dict_len);
+}
+
+int deflate_decompress_file(const char *dest, const char *src, int format) {
+    int in = src != NULL ? open(src, O_RDONLY) : STDIN_FILENO;
+    if (in < 0) {
+        return ERR_READ;
+    }
+    int out = dest != NULL ? open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666) : STDOUT_FILENO;
+    if (out < 0) {
+        if (src != NULL) close(in);
+        return ERR_WRITE;
+    }
+    struct deflate_mapping input;
+    struct deflate_sink sink = deflate_sink_fd(out);
+    int result;
+    if (deflate_map_input(in, &input)) {
+        result = decompress_input(&sink, NULL, &input, format, NULL, 0);
+        deflate_unmap_input(&input);
+    } else {
+        FILE *file = src != NULL ? fdopen(in, "rb") : stdin;
+        result = file != NULL ? decompress_input(&sink, file, NULL, format, NULL, 0) : ERR_READ;
+        if (file != NULL && src != NULL) {
+            fclose(file);
+            in = -1;
+        }
+    }
+    if (src != NULL && in >= 0) close(in);
+    if (dest != NULL) close(out);
+    return result;
+}
+
+int deflate_decompress_buffer(const void *in, size_t in_len, void *out, size_t out_cap, size_t *out_len) {
+    // the output buffer is the whole output, so repetitions are read straight from it, and there's no window
+    struct decompressor_state d;
+    init_state(&d, NULL);
+    bitreader_init(&d.in, in, in_len);
+    d.out_buf = out;
+    d.out_buf_size = out_cap;
+    int result = decode(&d);
+    *out_len = d.out_buf_index;
+    if (result == DECOMPRESS_NEED_OUTPUT) {
+        return ERR_OUTPUT_TOO_SMALL;
+    } else if (result == DECOMPRESS_NEED_INPUT) {
+        // the input ended before the final block
+        return ERR_INVALID_DEFLATE;
+    }
+    return result;
+}
+
+int deflate_index_build(const void *in, size_t in_len, size_t span, struct deflate_index **index) {
+    struct deflate_index *idx = malloc(sizeof(struct deflate_index));
+    struct decompressor_stream *stream = malloc(sizeof(struct decompressor_stream));
+    *index = NULL;
+    if (idx == NULL || stream == NULL) {
+        free(idx);
+        free(stream);
+        return ERR_NO_MEMORY;
+    }
+    struct decompressor_state *d = &stream->state;
+    idx->points = 0;
+    idx->point = NULL;
+    idx->out_len = 0;
+    size_t capacity = 0;
+    decompressor_stream_init(stream);
+    d->stop_at_blocks = true;
+    bitreader_init(&d->in, in, in_len);
+    int result;
+    for (;;) {
+        result = decode(d);
+        // the output isn't needed, only the window
+        idx->out_len += d->out_buf_index - d->out_flushed;
+        d->out_flushed = d->out_buf_index;
+        if (result == DECOMPRESS_NEED_OUTPUT) {
+            continue;
+        } else if (result != DECOMPRESS_BLOCK_END) {
+            break;
+        }
+        if (idx->points > 0 && idx->out_len - idx->point[idx->points - 1].out_offset < span) {
+            continue;
+        }
+        if (idx->points == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            struct deflate_index_point *grown = realloc(idx->point, capacity * sizeof(struct deflate_index_point));
+            if (grown == NULL) {
+                result = ERR_NO_MEMORY;
+                break;
+            }
+            idx->point = grown;
+        }
+        struct deflate_index_point *p = &idx->point[idx->points++];
+        p->in_bit = (size_t)(d->in.next - (const unsigned char *)in) * 8 - d->in.bit_count;
+        p->out_offset = idx->out_len;
+        p->window_len = d->out_buf_index < DECOMPRESS_WINDOW_SIZE ? d->out_buf_index : DECOMPRESS_WINDOW_SIZE;
+        memcpy(p->window, d->window + d->out_buf_index - p->window_len, p->window_len);
+    }
+    free(stream);
+    if (result == DECOMPRESS_NEED_INPUT) {
+        // the input ended before the final block
+        result = ERR_INVALID_DEFLATE;
+    }
+    if (result != DECOMPRESS_DONE) {
+        deflate_index_free(idx);
+        return result;
+    }
+    *index = idx;
     return 0;
 }
+
+void deflate_index_free(struct deflate_index *index) {
+    if (index != NULL) {
+        free(index->point);
+        free(index);
+    }
+}
+
+int deflate_decompress_range(const struct deflate_index *index, const void *in, size_t in_len,
+                             size_t out_offset, void *out, size_t len, size_t *out_len) {
+    *out_len = 0;
+    if (index->points == 0 || out_offset >= index->out_len) {
+        return 0;
+    }
+    // binary search for the last point at or before out_offset
+    size_t lo = 0, hi = index->points;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->point[mid].out_offset <= out_offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    const struct deflate_index_point *p = &index->point[lo];
+
+    struct decompressor_stream *stream = malloc(sizeof(struct decompressor_stream));
+    if (stream == NULL) {
+        return ERR_NO_MEMORY;
+    }
+    decompressor_stream_init(stream);
+    struct decompressor_state *d = &stream->state;
+    // start from the block header, with the window as history
+    bitreader_init(&d->in, (const unsigned char *)in + p->in_bit / 8, in_len - p->in_bit / 8);
+    if (p->in_bit % 8 != 0) {
+        bitreader_fill(&d->in, 8);
+        bitreader_consume(&d->in, p->in_bit % 8);
+    }
+    memcpy(d->window, p->window, p->window_len);
+    d->out_buf_index = d->out_flushed = p->window_len;
+
+    size_t skip = out_offset - p->out_offset;
+    int result;
+    for (;;) {
+        result = decode(d);
+        size_t pending = d->out_buf_index - d->out_flushed;
+        size_t skipped = pending < skip ? pending : skip;
+        skip -= skipped;
+        pending -= skipped;
+        if (pending > len - *out_len) {
+            pending = len - *out_len;
+        }
+        memcpy((unsigned char *)out + *out_len, d->window + d->out_flushed + skipped, pending);
+        *out_len += pending;
+        d->out_flushed = d->out_buf_index;
+        if (*out_len == len || result == DECOMPRESS_DONE) {
+            result = 0;
+            break;
+        } else if (result != DECOMPRESS_NEED_OUTPUT) {
+            // the input ended before the final block, or isn't valid
+            result = result == DECOMPRESS_NEED_INPUT ? ERR_INVALID_DEFLATE : result;
+            break;
+        }
+    }
+    free(stream);
+    return result;
+}
+
+// Batch decompression
+#define BATCH_READ_SIZE 65536 // bytes of every read of a batch worker
+
+// reads a job's input for a batch worker, a buffer ahead of the decoder
+struct batch_reader {
+    int fd;                  // the job's input
+    int error;               // ERR_READ if reading failed, otherwise 0
+    int next;                // buffer the next read goes to
+    bool pending;            // whether the read into buf[next] was started and isn't finished
+    int ring_fd;             // the io_uring, or -1 to read with read when the data is needed
+    void *sq_ring;           // the io_uring's submission ring, completion ring and submissions, as mapped
+    void *cq_ring;
+    struct io_uring_sqe *sqes;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned char buf[2][BATCH_READ_SIZE];
+};
+
+static void uring_free(struct batch_reader *r) {
+    if (r->ring_fd < 0) {
+        return;
+    }
+    if (r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_size);
+    if (r->cq_ring != MAP_FAILED) munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_size);
+    close(r->ring_fd);
+    r->ring_fd = -1;
+}
+
+// sets up an io_uring for one read at a time, which reads from the file position like read does
+// leaves ring_fd at -1 if the system can't
+static void uring_init(struct batch_reader *r) {
+    r->ring_fd = -1;
+#ifdef SYS_io_uring_setup
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    r->ring_fd = syscall(SYS_io_uring_setup, 2, &params);
+    if (r->ring_fd < 0) {
+        r->ring_fd = -1;
+        return;
+    }
+    r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                      IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                      IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                   IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED ||
+        !(params.features & IORING_FEAT_RW_CUR_POS)) {
+        uring_free(r);
+        return;
+    }
+    unsigned char *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + params.sq_off.array);
+    r->cq_head = (unsigned *)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+#endif
+}
+
+// starts reading into buf[next], if there is an io_uring. otherwise it's read when it's needed
+static void start_read(struct batch_reader *r) {
+#ifdef SYS_io_uring_setup
+    if (r->ring_fd < 0) {
+        return;
+    }
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r->fd;
+    sqe->addr = (uintptr_t)r->buf[r->next];
+    sqe->len = BATCH_READ_SIZE;
+    sqe->off = (uint64_t)-1; // from the file position
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (syscall(SYS_io_uring_enter, r->ring_fd, 1, 0, 0, NULL, 0) == 1) {
+        r->pending = true;
+    } else {
+        // take the submission back, and read when it's needed
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+    }
+#else
+    (void)r;
+#endif
+}
+
+// finishes the read into buf[next]
+// returns the number of bytes read, 0 at the end of the input, or less than 0 if reading failed
+static ssize_t finish_read(struct batch_reader *r) {
+#ifdef SYS_io_uring_setup
+    while (r->pending) {
+        unsigned head = *r->cq_head;
+        if (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            int res = r->cqes[head & *r->cq_mask].res;
+            __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+            r->pending = false;
+            if (res != -EINVAL) {
+                return res;
+            }
+            // the system has io_uring without reads, so read the usual way from now on
+            uring_free(r);
+            break;
+        }
+        syscall(SYS_io_uring_enter, r->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+#endif
+    ssize_t len;
+    do {
+        len = read(r->fd, r->buf[r->next], BATCH_READ_SIZE);
+    } while (len < 0 && errno == EINTR);
+    return len;
+}
+
+// gives the next span of input, and starts reading the one after it
+// returns false at the end of the input
+static bool batch_read(struct batch_reader *r, const unsigned char **data, size_t *len) {
+    ssize_t got = finish_read(r);
+    if (got <= 0) {
+        if (got < 0) r->error = ERR_READ;
+        return false;
+    }
+    *data = r->buf[r->next];
+    *len = got;
+    r->next ^= 1;
+    start_read(r);
+    return true;
+}
+
+struct batch_worker {
+    struct deflate_batch *batch;
+    pthread_t thread;
+    struct decompressor_stream *d; // reused by every job
+    unsigned char *ring;           // output ring from map_ring, or NULL
+    struct batch_reader *reader;
+};
+
+struct deflate_batch {
+    pthread_mutex_t lock;
+    pthread_cond_t submitted;             // a job was queued, or the batch is stopping
+    pthread_cond_t finished;              // a job is done
+    struct deflate_batch_job *queue;      // jobs waiting for a worker, first to last
+    struct deflate_batch_job *queue_last;
+    struct deflate_batch_job *done;       // jobs done, waiting for the caller, first to last
+    struct deflate_batch_job *done_last;
+    int outstanding;                      // jobs submitted and not given back yet
+    bool stopping;                        // whether workers stop when the queue is empty
+    int workers;                          // number of workers which were started
+    struct batch_worker worker[];
+};
+
+static void push_job(struct deflate_batch_job **first, struct deflate_batch_job **last, struct deflate_batch_job *job) {
+    job->next = NULL;
+    if (*first == NULL) {
+        *first = job;
+    } else {
+        (*last)->next = job;
+    }
+    *last = job;
+}
+
+static struct deflate_batch_job *pop_job(struct deflate_batch_job **first) {
+    struct deflate_batch_job *job = *first;
+    if (job != NULL) {
+        *first = job->next;
+    }
+    return job;
+}
+
+static int batch_decompress(struct batch_worker *w, struct deflate_batch_job *job) {
+    struct batch_reader *r = w->reader;
+    struct file_input input;
+    input.src = NULL;
+    input.reader = r;
+    input.header_crc = CRC32_INIT;
+    r->fd = job->src;
+    r->error = 0;
+    r->next = 0;
+    r->pending = false;
+    start_read(r);
+    // the stream starts with no input, and asks for the first span
+    int result = decompress_with(w->d, w->ring, &job->dest, &input, NULL, job->format, NULL, 0);
+    // the input which was read after the data is given back by moving the file position back over it,
+    // so the caller can read on from there. a pipe can't, and then it's lost
+    const struct bitreader *in = &w->d->state.in;
+    off_t unused = (in->end - in->next) + in->bit_count / 8;
+    if (r->pending) {
+        // the buffer can't be used again until the read is finished
+        ssize_t got = finish_read(r);
+        if (got > 0) unused += got;
+    }
+    if (result == 0 && r->error == 0 && unused > 0) {
+        lseek(job->src, -unused, SEEK_CUR);
+    }
+    return r->error != 0 ? r->error : result;
+}
+
+static void *batch_work(void *arg) {
+    struct batch_worker *w = arg;
+    struct deflate_batch *b = w->batch;
+    pthread_mutex_lock(&b->lock);
+    for (;;) {
+        while (b->queue == NULL && !b->stopping) {
+            pthread_cond_wait(&b->submitted, &b->lock);
+        }
+        struct deflate_batch_job *job = pop_job(&b->queue);
+        if (job == NULL) {
+            break;
+        }
+        pthread_mutex_unlock(&b->lock);
+        job->result = batch_decompress(w, job);
+        pthread_mutex_lock(&b->lock);
+        push_job(&b->done, &b->done_last, job);
+        pthread_cond_signal(&b->finished);
+    }
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+static void free_worker(struct batch_worker *w) {
+    if (w->reader != NULL) uring_free(w->reader);
+    if (w->ring != NULL) munmap(w->ring, 2 * RING_SIZE);
+    free(w->reader);
+    free(w->d);
+}
+
+struct deflate_batch *deflate_batch_new(int workers) {
+    if (workers < 1) workers = 1;
+    struct deflate_batch *b = malloc(sizeof(struct deflate_batch) + workers * sizeof(struct batch_worker));
+    if (b == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->submitted, NULL);
+    pthread_cond_init(&b->finished, NULL);
+    b->queue = b->done = NULL;
+    b->outstanding = 0;
+    b->stopping = false;
+    b->workers = 0;
+    for (int t = 0; t < workers; t++) {
+        struct batch_worker *w = &b->worker[t];
+        w->batch = b;
+        w->d = malloc(sizeof(struct decompressor_stream));
+        w->reader = malloc(sizeof(struct batch_reader));
+        w->ring = NULL;
+        if (w->reader != NULL) w->reader->ring_fd = -1;
+        if (w->d == NULL || w->reader == NULL) {
+            free_worker(w);
+            deflate_batch_free(b);
+            return NULL;
+        }
+        uring_init(w->reader);
+        w->ring = map_ring(RING_SIZE);
+        if (pthread_create(&w->thread, NULL, batch_work, w) != 0) {
+            free_worker(w);
+            deflate_batch_free(b);
+            return NULL;
+        }
+        b->workers += 1;
+    }
+    return b;
+}
+
+void deflate_batch_submit(struct deflate_batch *b, struct deflate_batch_job *job) {
+    pthread_mutex_lock(&b->lock);
+    push_job(&b->queue, &b->queue_last, job);
+    b->outstanding += 1;
+    pthread_cond_signal(&b->submitted);
+    pthread_mutex_unlock(&b->lock);
+}
+
+struct deflate_batch_job *deflate_batch_next(struct deflate_batch *b, bool wait) {
+    pthread_mutex_lock(&b->lock);
+    while (wait && b->done == NULL && b->outstanding > 0) {
+        pthread_cond_wait(&b->finished, &b->lock);
+    }
+    struct deflate_batch_job *job = pop_job(&b->done);
+    if (job != NULL) {
+        b->outstanding -= 1;
+    }
+    pthread_mutex_unlock(&b->lock);
+    return job;
+}
+
+void deflate_batch_free(struct deflate_batch *b) {
+    pthread_mutex_lock(&b->lock);
+    b->stopping = true;
+    pthread_cond_broadcast(&b->submitted);
+    pthread_mutex_unlock(&b->lock);
+    for (int t = 0; t < b->workers; t++) {
+        pthread_join(b->worker[t].thread, NULL);
+        free_worker(&b->worker[t]);
+    }
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->submitted);
+    pthread_cond_destroy(&b->finished);
+    free(b);
+}
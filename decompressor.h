@@ -1,9 +1,181 @@
 #ifndef GUARD_8c157709_e8f5_4bf5_b86e_bf2be4b7d787
 #define GUARD_8c157709_e8f5_4bf5_b86e_bf2be4b7d787
 #include "deflate.h"
+#include "bitreader.h"
+#include "huffman.h"
 // Decompresses from src to dest
 // Deflate sets a bit on the last block, so it stops itself
 // Returns 0 if successful, otherwise an error code
-#define ERR_INVALID_DEFLATE 1
 int decompressor(FILE *dest, FILE *src);
+
+// Decompresses from src to a sink
+// format is FORMAT_RAW, FORMAT_ZLIB or FORMAT_GZIP. gzip can be several members one after the other
+// Returns 0 if successful, otherwise an error code
+int decompressor_sink(const struct deflate_sink *dest, FILE *src, int format);
+
+// Like decompressor_sink, with the preset dictionary the data was compressed with, or NULL
+// Raw data is always decompressed with it. zlib data says whether it needs a dictionary, and which one,
+// and ERR_DICTIONARY is returned if it isn't this one. gzip has no dictionaries
+int decompressor_sink_dict(const struct deflate_sink *dest, FILE *src, int format, const void *dict, size_t dict_len);
+
+// Decompresses the file src to the file dest, or stdin or stdout if they are NULL
+// format is FORMAT_RAW, FORMAT_ZLIB or FORMAT_GZIP
+// A regular file is mapped instead of read, and the output is written straight from the history, so
+// nothing is copied on the way. Anything else, like a pipe, is read as a stream
+// Returns 0 if successful, otherwise an error code
+int deflate_decompress_file(const char *dest, const char *src, int format);
+
+// Decompresses in_len bytes from in into out, which has room for out_cap bytes
+// The output buffer is also the history for repetitions, so nothing is copied or allocated, and only
+// a struct decompressor_state, about 6K, goes on the stack
+// Sets out_len to the number of bytes written
+// Returns 0 if successful, ERR_OUTPUT_TOO_SMALL if the output doesn't fit, otherwise an error code
+int deflate_decompress_buffer(const void *in, size_t in_len, void *out, size_t out_cap, size_t *out_len);
+
+// Streaming decompression
+// A stream is initialised once, and then called with whatever input is available and room for output.
+// Everything needed to continue is kept in the struct between calls, including codes which were
+// only partially read, so a stream never blocks or allocates.
+#define DECOMPRESS_DONE         0  // the final block ended
+#define DECOMPRESS_NEED_INPUT  -1  // all of the input was used, call again with more
+#define DECOMPRESS_NEED_OUTPUT -2  // the output is full, call again with more room
+
+#define DECOMPRESS_WINDOW_SIZE 32768 // how far back a repetition can reach
+
+// A dynamic block's tables are built one after the other in an arena, which starts over at every
+// block. The code length table is only needed until the other two are built, so it goes first and
+// they go over it.
+#define DECOMPRESS_ARENA_SIZE (HUFFMAN_LITLEN_ENOUGH + HUFFMAN_DIST_ENOUGH)
+
+// Everything a stream needs but its window. deflate_decompress_buffer only needs this, since its output
+// buffer is the history
+struct decompressor_state {
+    int mode;                     // what the stream is in the middle of
+    bool last;                    // whether the current block is the final one
+    struct bitreader in;          // the current input, and bits read from it
+    unsigned char *out_buf;       // output, used for repetitions. the window, or the caller's buffer
+    size_t out_buf_index;         // index in out_buf
+    size_t out_buf_size;          // size of out_buf
+    size_t out_flushed;           // bytes of out_buf before this were given to the caller
+    size_t ring_size;             // if not 0, out_buf is this much memory mapped twice in a row
+    int length;                   // bytes left to copy, of a non-compressed block or a repetition
+    int distance;                 // distance of the repetition being copied
+    int hlit;                     // number of literal/length codes in a dynamic huffman block
+    int hdist;                    // number of distance codes in a dynamic huffman block
+    int hclen;                    // number of code length codes in a dynamic huffman block
+    int lengths_read;             // number of code lengths read so far
+    int lengths[286 + 32];        // code lengths of a dynamic huffman block
+    bool stop_at_blocks;          // whether decoding stops before every block header, for building an index
+    bool stopped;                 // whether decoding already stopped before the current block header
+    const uint32_t *literal_codes; // literal/length table of the current block, in the arena or the fixed one
+    const uint32_t *distnce_codes; // distance table of the current block, in the arena or the fixed one
+    int arena_used;                // entries of arena taken by the current block's tables
+#ifdef DEFLATE_STATS
+    struct deflate_stats *stats;   // counts what the stream does, or NULL
+    uint64_t stats_since;          // when the time was last added to the stats
+    bool stats_header;             // whether the stream was reading a header then
+#endif
+    unsigned char *window;         // the stream's window, or NULL if out_buf is the whole output
+    uint32_t arena[DECOMPRESS_ARENA_SIZE]; // decoding tables of the current dynamic block
+};
+
+// A stream keeps its history in window, inside the struct, so it needs no allocation and nothing to free.
+// When window fills up, its last DECOMPRESS_WINDOW_SIZE bytes are moved to the front, which copies about a
+// byte for every byte of output. decompressor_sink and the batch decompress into a ring which is mapped
+// twice, where moving back is only changing an index, but a mapping can't live in a struct the caller
+// places. For big outputs, they are faster
+struct decompressor_stream {
+    struct decompressor_state state;
+    unsigned char window[2 * DECOMPRESS_WINDOW_SIZE]; // history, and output which wasn't given to the caller yet
+};
+
+// Prepares a stream for decompressing
+void decompressor_stream_init(struct decompressor_stream *d);
+
+// Puts a preset dictionary in the history of a stream, right after decompressor_stream_init, so repetitions
+// can reach into it. It isn't part of the output. Only the last DECOMPRESS_WINDOW_SIZE bytes matter
+void decompressor_stream_set_dictionary(struct decompressor_stream *d, const void *dict, size_t len);
+
+#ifdef DEFLATE_STATS
+// Counts what the stream does into stats from now on, or nothing if stats is NULL. see stats.h
+void decompressor_stream_set_stats(struct decompressor_stream *d, struct deflate_stats *stats);
+#endif
+
+// Decompresses as much of in as possible into out
+// Sets in_used to the number of input bytes used, which are never needed again, and out_len to the
+// number of bytes written to out
+// Returns DECOMPRESS_DONE, DECOMPRESS_NEED_INPUT, DECOMPRESS_NEED_OUTPUT or an error code
+int decompressor_stream_run(struct decompressor_stream *d, const void *in, size_t in_len, size_t *in_used,
+                            void *out, size_t out_cap, size_t *out_len);
+
+// Random access
+// An index remembers seek points at block boundaries: where the block starts in the input, how much
+// output came before it, and the last DECOMPRESS_WINDOW_SIZE bytes of that output, which is all a
+// block needs to be decompressed without the ones before it.
+struct deflate_index_point {
+    size_t in_bit;                                 // input bit offset of the block header
+    size_t out_offset;                             // number of output bytes before the block
+    size_t window_len;                             // bytes of window, less than the window size near the start
+    unsigned char window[DECOMPRESS_WINDOW_SIZE];  // the output right before the block
+};
+
+struct deflate_index {
+    size_t points;                     // number of seek points
+    size_t out_len;                    // length of the whole output
+    struct deflate_index_point *point; // seek points, ordered by out_offset
+};
+
+// Decompresses in_len bytes from in once, and makes a seek point at the first block boundary after
+// every span bytes of output
+// Sets index to the index, which deflate_index_free frees
+// Returns 0 if successful, otherwise an error code
+int deflate_index_build(const void *in, size_t in_len, size_t span, struct deflate_index **index);
+
+void deflate_index_free(struct deflate_index *index);
+
+// Decompresses len bytes of output starting at out_offset into out, starting from the nearest seek point.
+// in and in_len are the same as for deflate_index_build
+// Sets out_len to the number of bytes written, which is less than len at the end of the output
+// Returns 0 if successful, otherwise an error code
+int deflate_decompress_range(const struct deflate_index *index, const void *in, size_t in_len,
+                             size_t out_offset, void *out, size_t len, size_t *out_len);
+
+// Batch decompression
+// A batch decompresses many independent inputs on a fixed set of worker threads. Every worker keeps its
+// stream, output ring and input buffers from one job to the next, and reads the next span of input while
+// it decodes the last one, through its own io_uring when the system has one. Without one, it reads with
+// read when it needs the input, so reading and decoding take turns. Either way the output is written by
+// the worker between spans, not while it decodes.
+// Jobs come back through a queue in the order they finish.
+// When a job succeeded, its input's file position is right after the data, or its gzip or zlib trailer,
+// if the input can seek. Otherwise, like for a pipe or after an error, more of the input may have been read.
+struct deflate_batch_job {
+    int src;                        // file descriptor of the input, read from its current position
+    struct deflate_sink dest;       // where the output goes. it's called from a worker thread
+    int format;                     // FORMAT_RAW, FORMAT_ZLIB or FORMAT_GZIP
+    int result;                     // when the job is done, 0 if successful, otherwise an error code
+    void *context;                  // for the caller, the batch doesn't use it
+    struct deflate_batch_job *next; // used by the batch
+};
+
+struct deflate_batch;
+
+// Starts a batch with workers threads
+// Returns NULL if allocating or starting them failed
+struct deflate_batch *deflate_batch_new(int workers);
+
+// Queues a job, which must stay valid until deflate_batch_next gives it back
+void deflate_batch_submit(struct deflate_batch *b, struct deflate_batch_job *job);
+
+// Gives back the next job which is done. If wait, waits for one if none is done yet
+// Returns NULL if no job is done, or if every job submitted was already given back
+struct deflate_batch_job *deflate_batch_next(struct deflate_batch *b, bool wait);
+
+// Finishes the jobs which were submitted, and stops the workers
+void deflate_batch_free(struct deflate_batch *b);
+
+#ifdef MAKEFIXED
+// writes fixeddecode.h, see makefixed.c
+void makefixed_decode(FILE *out);
+#endif
 #endif
@@ -8,8 +8,37 @@
 #include <stdint.h>
 #include <endian.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #define MAX_CODEBITS 15   // a huffman code can't be more than 15 bits
 #define MAX_CODES    286  // there are only 286 codes encoded
+// error codes, returned by both the compressor and the decompressor
+#define ERR_INVALID_DEFLATE  1 // the input isn't valid deflate
+#define ERR_OUTPUT_TOO_SMALL 2 // the output buffer is too small for the output
+#define ERR_NO_MEMORY        3 // allocating failed
+#define ERR_WRITE            4 // writing the output failed
+#define ERR_BAD_CHECKSUM     5 // the container's checksum or length doesn't match the data
+#define ERR_DICTIONARY       6 // the zlib data needs a preset dictionary, and it wasn't given or is a different one
+#define ERR_READ             7 // opening or reading the input failed
+// containers around the deflate data
+#define FORMAT_RAW  0 // only deflate
+#define FORMAT_ZLIB 1 // RFC 1950: a 2 byte header, and the adler-32 of the data after it
+#define FORMAT_GZIP 2 // RFC 1952: a 10 byte header, and the crc-32 and length of the data after it
+#include "checksum.h"
+#include "sink.h"
+#include "stats.h"
 #include "compressor.h"
 #include "decompressor.h"
+#include "dictionary.h"
 #endif
@@ -3,12 +3,15 @@ import sys
 
 compress = sys.stdin.buffer.read()
 
-def deflate(data, compresslevel=9):
+# window bits for each container: negative is raw deflate, +16 is gzip
+formats = {"raw": -zlib.MAX_WBITS, "zlib": zlib.MAX_WBITS, "gzip": zlib.MAX_WBITS + 16}
+
+def deflate(data, compresslevel=9, wbits=-zlib.MAX_WBITS):
     compress = zlib.compressobj(
-        compresslevel, zlib.DEFLATED, -zlib.MAX_WBITS, zlib.DEF_MEM_LEVEL, 0
+        compresslevel, zlib.DEFLATED, wbits, zlib.DEF_MEM_LEVEL, 0
     )
     deflated = compress.compress(data)
     deflated += compress.flush()
     return deflated
 
-sys.stdout.buffer.write(deflate(compress))
+sys.stdout.buffer.write(deflate(compress, wbits=formats[sys.argv[1] if len(sys.argv) > 1 else "raw"]))
@@ -0,0 +1,119 @@
+#include "deflate.h"
+
+// The samples are cut into as many epochs as the dictionary has segments, and every epoch gives the
+// segment with the best score: the sum over its k-mers of how many samples have that k-mer. A k-mer only
+// scores for the first segment it's in, so the same piece isn't picked twice.
+#define KMER_SIZE    6   // bytes of a k-mer, about the shortest worthwhile repetition
+#define SEGMENT_SIZE 64  // bytes of a segment
+#define KMER_BITS    20  // bits of a k-mer's hash
+
+struct segment {
+    size_t position; // where the segment starts in the samples
+    uint64_t score;
+};
+
+static inline uint32_t hash_kmer(const unsigned char *p) {
+    uint64_t kmer = 0;
+    memcpy(&kmer, p, KMER_SIZE);
+    return (uint32_t)((kmer * 0x9e3779b97f4a7c15ull) >> (64 - KMER_BITS));
+}
+
+// worse segments first
+static int compare_segments(const void *a, const void *b) {
+    const struct segment *x = a, *y = b;
+    return x->score < y->score ? -1 : x->score > y->score;
+}
+
+// finds the best segment starting between start and end, which is at most SEGMENT_SIZE bytes before
+// the end of the samples, and takes its k-mers out of the counts
+static struct segment best_segment(const unsigned char *samples, size_t start, size_t end, uint32_t *counts) {
+    struct segment best = { start, 0 };
+    uint64_t score = 0;
+    // the score of the segment at p is the sum of the counts of the k-mers from p to p + SEGMENT_SIZE - KMER_SIZE
+    for (size_t p = start; p < start + SEGMENT_SIZE - KMER_SIZE; p++) {
+        score += counts[hash_kmer(samples + p)];
+    }
+    for (size_t p = start; p < end; p++) {
+        score += counts[hash_kmer(samples + p + SEGMENT_SIZE - KMER_SIZE)];
+        if (score > best.score) {
+            best.position = p;
+            best.score = score;
+        }
+        score -= counts[hash_kmer(samples + p)];
+    }
+    for (size_t p = best.position; p <= best.position + SEGMENT_SIZE - KMER_SIZE; p++) {
+        counts[hash_kmer(samples + p)] = 0;
+    }
+    return best;
+}
+
+int deflate_dictionary_build(const void *samples, const size_t *sample_lens, size_t count,
+                             void *dict, size_t dict_cap, size_t *dict_len) {
+    const unsigned char *in = samples;
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += sample_lens[i];
+    }
+    if (dict_cap > DICTIONARY_MAX_SIZE) {
+        dict_cap = DICTIONARY_MAX_SIZE;
+    }
+    if (total <= dict_cap || total < 2 * SEGMENT_SIZE || dict_cap < SEGMENT_SIZE) {
+        // all of it fits, or not even one segment does, so the end of the samples is the dictionary
+        size_t len = total < dict_cap ? total : dict_cap;
+        memcpy(dict, in + total - len, len);
+        *dict_len = len;
+        return 0;
+    }
+
+    // count how many samples have every k-mer. a k-mer in a single sample doesn't repeat across messages
+    uint32_t *counts = calloc(1 << KMER_BITS, sizeof(uint32_t));
+    uint32_t *last_sample = calloc(1 << KMER_BITS, sizeof(uint32_t)); // 1 + the last sample counted for a k-mer
+    size_t segments = dict_cap / SEGMENT_SIZE;
+    struct segment *picked = malloc(segments * sizeof(struct segment));
+    if (counts == NULL || last_sample == NULL || picked == NULL) {
+        free(counts);
+        free(last_sample);
+        free(picked);
+        return ERR_NO_MEMORY;
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (size_t p = offset; p + KMER_SIZE <= offset + sample_lens[i]; p++) {
+            uint32_t h = hash_kmer(in + p);
+            if (last_sample[h] != i + 1) {
+                last_sample[h] = i + 1;
+                counts[h] += 1;
+            }
+        }
+        offset += sample_lens[i];
+    }
+    for (uint32_t h = 0; h < 1 << KMER_BITS; h++) {
+        if (counts[h] == 1) {
+            counts[h] = 0;
+        }
+    }
+
+    // every epoch gives its best segment
+    size_t last_start = total - SEGMENT_SIZE; // the last position a whole segment starts at
+    size_t epoch = (last_start + segments) / segments;
+    size_t picked_count = 0;
+    for (size_t start = 0; start < last_start && picked_count < segments; start += epoch) {
+        size_t end = start + epoch < last_start ? start + epoch : last_start;
+        struct segment segment = best_segment(in, start, end, counts);
+        if (segment.score > 0) {
+            picked[picked_count++] = segment;
+        }
+    }
+
+    // the best segments go last
+    qsort(picked, picked_count, sizeof(struct segment), compare_segments);
+    unsigned char *out = dict;
+    for (size_t k = 0; k < picked_count; k++) {
+        memcpy(out + k * SEGMENT_SIZE, in + picked[k].position, SEGMENT_SIZE);
+    }
+    *dict_len = picked_count * SEGMENT_SIZE;
+    free(counts);
+    free(last_sample);
+    free(picked);
+    return 0;
+}
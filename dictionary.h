@@ -0,0 +1,19 @@
+#ifndef GUARD_cee8213b_83ee_41ed_9cc1_8350096a751d
+#define GUARD_cee8213b_83ee_41ed_9cc1_8350096a751d
+#include "deflate.h"
+// Preset dictionaries
+// Small messages have nothing before them to repeat, so most of a short message is literals. A preset
+// dictionary is data which comes before every message, on both sides, without being part of it. It's given
+// to compressor_context_set_dictionary, compressor_stream_set_dictionary or compressor_sink_dict, and
+// the same dictionary to decompressor_stream_set_dictionary or decompressor_sink_dict.
+#define DICTIONARY_MAX_SIZE 32768 // repetitions can't reach further back than this
+
+// Builds a dictionary of at most dict_cap bytes from samples which are like the messages it's for.
+// The samples are one after the other in samples, sample_lens[i] bytes each.
+// The pieces which are in the most samples are picked, and the best of them go at the end of the
+// dictionary, where repetitions of them are shortest
+// Sets dict_len to the length of the dictionary
+// Returns 0 if successful, otherwise an error code
+int deflate_dictionary_build(const void *samples, const size_t *sample_lens, size_t count,
+                             void *dict, size_t dict_cap, size_t *dict_len);
+#endif
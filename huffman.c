@@ -1,73 +1,247 @@
+#include "deflate.h"
 #include "huffman.h"
 
-void huffman_free(struct huffman *huff) {
-    if (huff->left != NULL) {
-        huffman_free(huff->left);
+// reverses the lowest len bits of code
+static unsigned int reverse_bits(unsigned int code, int len) {
+    unsigned int reversed = 0;
+    for (int i = 0; i < len; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
     }
-    if (huff->right != NULL) {
-        huffman_free(huff->right);
+    return reversed;
+}
+
+// the entry for a symbol, without the number of bits to consume
+static uint32_t symbol_entry(int symbol, const struct huffman_alphabet *alphabet) {
+    if (symbol < alphabet->literals) {
+        return ((uint32_t)symbol << 16) | HUFFMAN_LITERAL;
+    }
+    if (symbol == alphabet->end_of_block) {
+        return HUFFMAN_END;
+    }
+    int i = symbol - alphabet->first_base;
+    if (i < 0 || i >= alphabet->bases) {
+        return HUFFMAN_INVALID;
     }
-    free(huff);
+    return ((uint32_t)alphabet->base[i] << 16) | (alphabet->extra[i] << 4);
 }
 
-struct huffman *huffman_construct(int *lengths, int count) {
+int huffman_table_build(uint32_t *table, int table_bits, int size,
+                        const int *lengths, int count, const struct huffman_alphabet *alphabet) {
     // count the number of codes for each code length
-    int bl_count[MAX_CODES] = {0};
+    int bl_count[MAX_CODEBITS + 1] = {0};
     for (int i = 0; i < count; i++) {
+        if (lengths[i] < 0 || lengths[i] > MAX_CODEBITS) {
+            return -1;
+        }
         bl_count[lengths[i]] += 1;
     }
     bl_count[0] = 0;
 
-    // generate the first code for each length
+    // reject over-subscribed codes, and incomplete codes unless they have a single code of one bit
+    int left = 1;
+    int codes = 0;
+    for (int bits = 1; bits <= MAX_CODEBITS; bits++) {
+        left = (left << 1) - bl_count[bits];
+        if (left < 0) {
+            return -1;
+        }
+        codes += bl_count[bits];
+    }
+    if (left > 0 && codes > 0 && !(codes == 1 && bl_count[1] == 1)) {
+        return -1;
+    }
+
+    // generate the first code for each length, and the codes themselves
     int code = 0;
-    int next_code[MAX_CODES + 1];
+    int next_code[MAX_CODEBITS + 1];
+    next_code[0] = 0;
     for (int bits = 1; bits <= MAX_CODEBITS; ++bits) {
         code = (code + bl_count[bits - 1]) << 1;
         next_code[bits] = code;
     }
 
-    // generate the huffman tree
-    struct huffman *tree = (struct huffman *)calloc(1, sizeof(struct huffman));
+    // sort the symbols by code length, which is the order of their codes
+    int offsets[MAX_CODEBITS + 2];
+    offsets[1] = 0;
+    for (int bits = 1; bits <= MAX_CODEBITS; bits++) {
+        offsets[bits + 1] = offsets[bits] + bl_count[bits];
+    }
+    int sorted[MAX_CODES + 2];
+    uint16_t sorted_codes[MAX_CODES + 2];
     for (int i = 0; i < count; i++) {
-        int code_len = lengths[i];
-        if (code_len != 0) {
-            uint16_t code = next_code[code_len]++;
-            // we know the code, now we just need to put it on the tree
-            struct huffman *node = tree;
-            // read code bit by bit
-            code <<= (16 - lengths[i]);
-            for (int j = 0; j < lengths[i]; j++) {
-                if (code & 0b1000000000000000) {
-                    // go right
-                    if (node->right == NULL) {
-                        node->right = (struct huffman *)calloc(1, sizeof(struct huffman));
-                    }
-                    node = node->right;
-                } else {
-                    // go left
-                    if (node->left == NULL) {
-                        node->left = (struct huffman *)calloc(1, sizeof(struct huffman));
-                    }
-                    node = node->left;
+        if (lengths[i] != 0) {
+            int j = offsets[lengths[i]]++;
+            sorted[j] = i;
+            sorted_codes[j] = next_code[lengths[i]]++;
+        }
+    }
+
+    int primary_size = 1 << table_bits;
+    if (primary_size > size) {
+        return -1;
+    }
+    for (int i = 0; i < primary_size; i++) {
+        table[i] = HUFFMAN_INVALID;
+    }
+
+    int used = primary_size;
+    int subtable_prefix = -1; // primary index of the current subtable
+    int subtable = 0;         // offset of the current subtable
+    for (int j = 0; j < codes; j++) {
+        int symbol = sorted[j];
+        int len = lengths[symbol];
+        unsigned int reversed = reverse_bits(sorted_codes[j], len);
+        uint32_t entry = symbol_entry(symbol, alphabet);
+        if (len <= table_bits) {
+            // fill every index which starts with this code
+            for (unsigned int k = reversed; k < (unsigned int)primary_size; k += 1 << len) {
+                table[k] = entry | len;
+            }
+            continue;
+        }
+
+        int prefix = reversed & (primary_size - 1);
+        if (prefix != subtable_prefix) {
+            // a new subtable, big enough for the longest code starting with this prefix.
+            // codes are sorted, so all of the codes with the same prefix come one after the other
+            int max_len = len;
+            for (int k = j + 1; k < codes; k++) {
+                int k_len = lengths[sorted[k]];
+                if ((sorted_codes[k] >> (k_len - table_bits)) != (sorted_codes[j] >> (len - table_bits))) {
+                    break;
                 }
-                code <<= 1;
+                max_len = k_len;
             }
-            node->value = i;
+            int subtable_bits = max_len - table_bits;
+            if (used + (1 << subtable_bits) > size) {
+                return -1;
+            }
+            subtable = used;
+            subtable_prefix = prefix;
+            used += 1 << subtable_bits;
+            for (int k = subtable; k < used; k++) {
+                table[k] = HUFFMAN_INVALID;
+            }
+            table[prefix] = ((uint32_t)subtable << 16) | HUFFMAN_SUBTABLE | (subtable_bits << 4) | table_bits;
         }
+        int subtable_size = 1 << HUFFMAN_EXTRA(table[prefix]);
+        for (int k = reversed >> table_bits; k < subtable_size; k += 1 << (len - table_bits)) {
+            table[subtable + k] = entry | (len - table_bits);
+        }
+    }
+    return used;
+}
+
+void huffman_codes(const int *lengths, int count, uint16_t *codes) {
+    int bl_count[MAX_CODEBITS + 1] = {0};
+    for (int i = 0; i < count; i++) {
+        bl_count[lengths[i]] += 1;
+    }
+    bl_count[0] = 0;
+
+    int code = 0;
+    int next_code[MAX_CODEBITS + 1];
+    for (int bits = 1; bits <= MAX_CODEBITS; ++bits) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < count; i++) {
+        codes[i] = lengths[i] == 0 ? 0 : reverse_bits(next_code[lengths[i]]++, lengths[i]);
     }
-    return tree;
 }
 
-#ifdef DEFLATE_DEBUGGING
-void huffman_print(struct huffman *huff) {
-    if (huff == NULL) {
-        printf("null");
-    } else {
-        printf("{\"val\": %d, \"L\": ", huff->value);
-        huffman_print(huff->left);
-        printf(", \"R\": ");
-        huffman_print(huff->right);
-        printf("}");
+// a symbol with its frequency, for sorting
+struct weighted_symbol {
+    int freq;
+    int symbol;
+};
+
+static int compare_weighted_symbols(const void *a, const void *b) {
+    const struct weighted_symbol *x = a, *y = b;
+    if (x->freq != y->freq) return x->freq < y->freq ? -1 : 1;
+    return x->symbol - y->symbol;
+}
+
+void huffman_lengths(const int *freqs, int count, int max_bits, int *lengths) {
+    struct weighted_symbol leaves[MAX_HUFFMAN_SYMBOLS];
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        lengths[i] = 0;
+        if (freqs[i] != 0) {
+            leaves[n++] = (struct weighted_symbol){freqs[i], i};
+        }
+    }
+    // a single code can't be complete, so give codes to unused symbols until there are two
+    for (int i = 0; n < 2 && i < count; i++) {
+        if (freqs[i] == 0) {
+            leaves[n++] = (struct weighted_symbol){0, i};
+        }
+    }
+    if (n < 2) {
+        // an alphabet of one symbol
+        if (n == 1) lengths[leaves[0].symbol] = 1;
+        return;
+    }
+    qsort(leaves, n, sizeof(leaves[0]), compare_weighted_symbols);
+
+    // build the tree with two queues: the leaves, sorted, and the internal nodes, which are made
+    // in order of weight. nodes 0 to n-1 are leaves, and n to 2n-2 are internal nodes
+    int weight[2 * MAX_HUFFMAN_SYMBOLS];
+    int parent[2 * MAX_HUFFMAN_SYMBOLS];
+    for (int i = 0; i < n; i++) {
+        weight[i] = leaves[i].freq;
+    }
+    int next_leaf = 0, next_node = n;
+    for (int node = n; node < 2 * n - 1; node++) {
+        weight[node] = 0;
+        for (int child = 0; child < 2; child++) {
+            int smallest;
+            if (next_leaf < n && (next_node == node || weight[next_leaf] <= weight[next_node])) {
+                smallest = next_leaf++;
+            } else {
+                smallest = next_node++;
+            }
+            weight[node] += weight[smallest];
+            parent[smallest] = node;
+        }
+    }
+
+    // depths go down from the root, which is the last node. a node's parent always comes after it
+    int depth[2 * MAX_HUFFMAN_SYMBOLS];
+    int bl_count[MAX_CODEBITS + 1] = {0};
+    depth[2 * n - 2] = 0;
+    for (int node = 2 * n - 3; node >= 0; node--) {
+        depth[node] = depth[parent[node]] + 1;
+        if (node < n) {
+            // too long codes are cut to max_bits for now, which over-subscribes the code
+            bl_count[depth[node] > max_bits ? max_bits : depth[node]] += 1;
+        }
+    }
+
+    // make the code fit again: every step moves a max_bits code up to a shorter length's place,
+    // and splits that shorter code in two, until the kraft sum is exactly 1
+    unsigned int total = 0;
+    for (int len = 1; len <= max_bits; len++) {
+        total += (unsigned int)bl_count[len] << (max_bits - len);
+    }
+    while (total > (1u << max_bits)) {
+        bl_count[max_bits] -= 1;
+        for (int len = max_bits - 1; len > 0; len--) {
+            if (bl_count[len] != 0) {
+                bl_count[len] -= 1;
+                bl_count[len + 1] += 2;
+                break;
+            }
+        }
+        total -= 1;
+    }
+
+    // the least frequent symbols get the longest codes
+    int leaf = 0;
+    for (int len = max_bits; len > 0; len--) {
+        for (int k = 0; k < bl_count[len]; k++) {
+            lengths[leaves[leaf++].symbol] = len;
+        }
     }
 }
-#endif
@@ -1,20 +1,57 @@
 #ifndef GUARD_1e252457_729e_463f_bbcd_0d45520c797c
 #define GUARD_1e252457_729e_463f_bbcd_0d45520c797c
-#include "deflate.h"
 #include <stdlib.h>
-struct huffman {
-    int value;             // isn't used if left or right aren't null
-    struct huffman *left;  // represented by 0
-    struct huffman *right; // represented by 1
+#include <stdint.h>
+// Decoding tables
+// A table is indexed by the next table_bits bits of input. Deflate packs huffman codes starting
+// from their most significant bit, so the index is the code with its bits reversed.
+// Codes longer than table_bits point to a subtable, which is indexed by the bits after them.
+// Every entry is packed into 32 bits:
+//   bits 0-3   bits to consume: the code length (length minus table_bits inside a subtable)
+//   bits 4-7   extra bits after the code, or the number of bits indexing a subtable
+//   bits 8-15  flags
+//   bits 16-31 literal, base length/distance, or subtable offset
+#define HUFFMAN_LITERAL  0x100 // value is a literal (or a code length symbol)
+#define HUFFMAN_END      0x200 // end of block
+#define HUFFMAN_SUBTABLE 0x400 // value is the offset of a subtable
+#define HUFFMAN_INVALID  0x800 // no code has these bits
+
+#define HUFFMAN_BITS(entry)  ((entry) & 0xf)
+#define HUFFMAN_EXTRA(entry) (((entry) >> 4) & 0xf)
+#define HUFFMAN_VALUE(entry) ((entry) >> 16)
+
+// primary table bits and maximum table sizes (including subtables) for each alphabet
+#define HUFFMAN_LITLEN_BITS     9
+#define HUFFMAN_LITLEN_ENOUGH   852
+#define HUFFMAN_DIST_BITS       6
+#define HUFFMAN_DIST_ENOUGH     592
+#define HUFFMAN_CODELEN_BITS    7
+#define HUFFMAN_CODELEN_ENOUGH  128
+
+// describes what the symbols of an alphabet decode to
+struct huffman_alphabet {
+    int literals;         // symbols below this are literals
+    int end_of_block;     // end of block symbol, or -1 if there is none
+    int first_base;       // first symbol with a base value and extra bits
+    int bases;            // number of symbols with a base value, the rest are invalid
+    const uint16_t *base; // base value for each symbol from first_base
+    const uint8_t *extra; // number of extra bits for each symbol from first_base
 };
 
-// recursively frees a huffman tree
-void huffman_free(struct huffman *huff);
+// builds a decoding table of at most size entries from the lengths
+// returns the number of entries used, or -1 if the lengths are not a valid code
+int huffman_table_build(uint32_t *table, int table_bits, int size,
+                        const int *lengths, int count, const struct huffman_alphabet *alphabet);
 
-// constructs a huffman tree from the lengths
-struct huffman *huffman_construct(int *lengths, int count);
+// generates the canonical codes for the lengths, with their bits reversed so they can be
+// written least significant bit first
+void huffman_codes(const int *lengths, int count, uint16_t *codes);
+
+// Encoding
+#define MAX_HUFFMAN_SYMBOLS 288 // the largest alphabet, literal/length
+
+// computes the lengths of an optimal prefix code for the frequencies, with no code longer than max_bits.
+// unused symbols get a length of 0, except that at least two symbols always get a code, so it's complete
+void huffman_lengths(const int *freqs, int count, int max_bits, int *lengths);
 
-#ifdef DEFLATE_DEBUGGING
-void huffman_print(struct huffman *huff);
-#endif
 #endif
@@ -1,8 +1,60 @@
 #include "deflate.h"
 
+// usage: compress [-1..-12] [--format=raw|zlib|gzip] [input [output]]
+//        decompress [--format=raw|zlib|gzip] [input [output]]
+// without files, it reads stdin and writes stdout. the exit status is 0, an error code, or USAGE_STATUS
+// when the command line is wrong
+#define USAGE_STATUS 64 // past the error codes, like EX_USAGE
+
+static int usage(void) {
+    fprintf(stderr, "usage: deflate compress [-1..-%d] [--format=raw|zlib|gzip] [input [output]]\n"
+                    "       deflate decompress [--format=raw|zlib|gzip] [input [output]]\n", MAX_LEVEL);
+    return USAGE_STATUS;
+}
+
+// the level of an option like -9, or 0 if it isn't one
+static int parse_level(const char *option) {
+    if (option[0] != '-' || option[1] < '1' || option[1] > '9') {
+        return 0;
+    }
+    int level = 0;
+    for (const char *p = option + 1; *p != '\0'; p++) {
+        if (*p < '0' || *p > '9' || level > MAX_LEVEL) {
+            return 0;
+        }
+        level = level * 10 + (*p - '0');
+    }
+    return level <= MAX_LEVEL ? level : 0;
+}
+
 int main(int argc, char **argv) {
-    if (!strcmp(argv[1], "compress")) {
-        return compressor(stdout, stdin);
+    if (argc < 2 || (strcmp(argv[1], "compress") != 0 && strcmp(argv[1], "decompress") != 0)) {
+        return usage();
+    }
+    bool compress = !strcmp(argv[1], "compress");
+    int level = DEFAULT_LEVEL;
+    int format = FORMAT_RAW;
+    const char *files[2] = { NULL, NULL };
+    int file_count = 0;
+    for (int i = 2; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "--format=raw")) {
+            format = FORMAT_RAW;
+        } else if (!strcmp(arg, "--format=zlib")) {
+            format = FORMAT_ZLIB;
+        } else if (!strcmp(arg, "--format=gzip")) {
+            format = FORMAT_GZIP;
+        } else if (compress && parse_level(arg) != 0) {
+            level = parse_level(arg);
+        } else if (arg[0] == '-' || arg[0] == '\0' || file_count == 2) {
+            // an unknown option, a level when decompressing, or a third file
+            return usage();
+        } else {
+            files[file_count++] = arg;
+        }
+    }
+    if (compress) {
+        return deflate_compress_file(files[1], files[0], level, format);
     }
-    return decompressor(stdout, stdin);
+    return deflate_decompress_file(files[1], files[0], format);
 }
@@ -0,0 +1,19 @@
+#include "deflate.h"
+
+// Writes the fixed huffman tables, so a fixed block costs no setup at all.
+// The tables aren't there before this runs, so everything is built with MAKEFIXED defined,
+// which makes compressor.c and decompressor.c build them instead of including them:
+//   cc -DMAKEFIXED -o makefixed makefixed.c compressor.c decompressor.c huffman.c checksum.c sink.c -pthread
+//   ./makefixed decode > fixeddecode.h
+//   ./makefixed encode > fixedencode.h
+int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "decode")) {
+        makefixed_decode(stdout);
+    } else if (argc > 1 && !strcmp(argv[1], "encode")) {
+        makefixed_encode(stdout);
+    } else {
+        fprintf(stderr, "usage: makefixed decode|encode\n");
+        return 1;
+    }
+    return 0;
+}
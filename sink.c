@@ -0,0 +1,102 @@
+#include "deflate.h"
+
+static int write_file(void *context, const void *data, size_t len) {
+    return fwrite(data, 1, len, context) == len ? 0 : ERR_WRITE;
+}
+
+static int write_fd(void *context, const void *data, size_t len) {
+    int fd = (int)(intptr_t)context;
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                // a signal came before anything was written
+                continue;
+            }
+            return ERR_WRITE;
+        }
+        data = (const unsigned char *)data + written;
+        len -= written;
+    }
+    return 0;
+}
+
+static int write_memory(void *context, const void *data, size_t len) {
+    struct deflate_memory *memory = context;
+    if (len > memory->cap - memory->len) {
+        size_t cap = memory->cap == 0 ? 65536 : memory->cap;
+        while (len > cap - memory->len) {
+            cap *= 2;
+        }
+        unsigned char *grown = realloc(memory->data, cap);
+        if (grown == NULL) {
+            return ERR_NO_MEMORY;
+        }
+        memory->data = grown;
+        memory->cap = cap;
+    }
+    memcpy(memory->data + memory->len, data, len);
+    memory->len += len;
+    return 0;
+}
+
+struct deflate_sink deflate_sink_file(FILE *file) {
+    return (struct deflate_sink){write_file, file};
+}
+
+struct deflate_sink deflate_sink_fd(int fd) {
+    return (struct deflate_sink){write_fd, (void *)(intptr_t)fd};
+}
+
+struct deflate_sink deflate_sink_memory(struct deflate_memory *memory) {
+    return (struct deflate_sink){write_memory, memory};
+}
+
+bool deflate_map_input(int fd, struct deflate_mapping *mapping) {
+    struct stat st;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || offset < 0) {
+        return false;
+    }
+    mapping->len = st.st_size - offset;
+    if (mapping->len == 0) {
+        // there is nothing to map, but an empty file is still read in place
+        mapping->data = (const unsigned char *)"";
+        return true;
+    }
+    // a mapping starts on a page, so the pages before the offset are mapped too
+    size_t skip = offset % sysconf(_SC_PAGESIZE);
+    void *data = mmap(NULL, mapping->len + skip, PROT_READ, MAP_PRIVATE, fd, offset - skip);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise(data, mapping->len + skip, MADV_SEQUENTIAL);
+    mapping->data = (const unsigned char *)data + skip;
+    return true;
+}
+
+void deflate_unmap_input(struct deflate_mapping *mapping) {
+    if (mapping->len > 0) {
+        size_t skip = (uintptr_t)mapping->data % sysconf(_SC_PAGESIZE);
+        munmap((void *)(mapping->data - skip), mapping->len + skip);
+    }
+}
+
+unsigned char *deflate_map_output(int fd, size_t cap) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (fcntl(fd, F_GETFL) & O_ACCMODE) != O_RDWR ||
+        lseek(fd, 0, SEEK_CUR) != 0 || ftruncate(fd, cap) != 0) {
+        return NULL;
+    }
+    void *out = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (out == MAP_FAILED) {
+        ftruncate(fd, 0);
+        return NULL;
+    }
+    return out;
+}
+
+int deflate_unmap_output(int fd, unsigned char *out, size_t cap, size_t len) {
+    munmap(out, cap);
+    return ftruncate(fd, len) == 0 ? 0 : ERR_WRITE;
+}
@@ -0,0 +1,51 @@
+#ifndef GUARD_364b8cd0_043a_4299_a968_eda12f707b5d
+#define GUARD_364b8cd0_043a_4299_a968_eda12f707b5d
+#include "deflate.h"
+// Where output goes
+// The compressor and decompressor give a sink their output in big spans, straight from their buffers
+struct deflate_sink {
+    int (*write)(void *context, const void *data, size_t len); // returns 0 if successful, otherwise an error code
+    void *context;
+};
+
+// output grown in memory with realloc, which the caller frees
+struct deflate_memory {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+};
+
+// Writes to a FILE with fwrite
+struct deflate_sink deflate_sink_file(FILE *file);
+
+// Writes to a file descriptor with write
+struct deflate_sink deflate_sink_fd(int fd);
+
+// Appends to memory, which must start zeroed
+struct deflate_sink deflate_sink_memory(struct deflate_memory *memory);
+
+// Mapped files
+// A regular file can be mapped instead of read, so the compressor and decompressor see all of it in place,
+// without copies. Pipes and terminals can't, and are read as streams.
+
+// a whole input file, read only
+struct deflate_mapping {
+    const unsigned char *data;
+    size_t len;
+};
+
+// Maps the rest of the file fd, if it's a regular file, and tells the system it's read from start to end
+// Returns false if it can't be mapped
+bool deflate_map_input(int fd, struct deflate_mapping *mapping);
+
+void deflate_unmap_input(struct deflate_mapping *mapping);
+
+// Makes the file fd, which must be a regular file opened for reading and writing, cap bytes long,
+// and maps it for writing
+// Returns NULL if it can't be mapped
+unsigned char *deflate_map_output(int fd, size_t cap);
+
+// Unmaps an output mapping of cap bytes, and cuts the file to the len bytes which were written
+// Returns 0 if successful, otherwise an error code
+int deflate_unmap_output(int fd, unsigned char *out, size_t cap, size_t len);
+#endif
@@ -0,0 +1,53 @@
+#ifndef GUARD_0ede47f8_072f_4762_90f6_a1d125d694d1
+#define GUARD_0ede47f8_072f_4762_90f6_a1d125d694d1
+#include "deflate.h"
+// Statistics
+// Built with DEFLATE_STATS defined, a stream or context counts what it does into a struct deflate_stats
+// which the caller gives it, with decompressor_stream_set_stats, compressor_stream_set_stats or
+// compressor_context_set_stats. The counts add up over everything done until it's taken away again.
+// Without DEFLATE_STATS, none of the counting is compiled in, and those functions don't exist.
+struct deflate_stats {
+    uint64_t stored_blocks;             // blocks of each type
+    uint64_t fixed_blocks;
+    uint64_t dynamic_blocks;
+    uint64_t stored_bytes;              // bytes in non-compressed blocks
+    uint64_t literals;                  // literals, and repetitions. the compressor counts the ones it found,
+    uint64_t matches;                   // even in blocks which are written non-compressed after all
+    uint64_t length_histogram[259];     // repetitions of every length, from 3 to 258
+    uint64_t distance_histogram[16];    // repetitions with a distance from 1 << k to (1 << (k + 1)) - 1
+    // decompressor only
+    uint64_t in_bits;                   // input bits used. divided by the output bytes, the cost of a byte
+    uint64_t header_ns;                 // time spent reading block headers and code lengths
+    uint64_t symbols_ns;                // time spent decoding literals and repetitions, and copying blocks
+    // compressor only
+    uint64_t searches;                  // times a hash chain was searched for a repetition
+    uint64_t probes;                    // positions compared, over all the searches
+    uint64_t chain_histogram[16];       // searches which compared from 1 << (k - 1) to (1 << k) - 1 positions
+};
+
+#ifdef DEFLATE_STATS
+// runs statement only if there are stats to count into
+#define STATS(stats, statement) do { if ((stats) != NULL) { statement; } } while (0)
+
+static inline void stats_match(struct deflate_stats *stats, int length, int distance) {
+    stats->matches += 1;
+    stats->length_histogram[length] += 1;
+    stats->distance_histogram[31 - __builtin_clz(distance)] += 1;
+}
+
+// one search of a hash chain, which compared probes positions
+static inline void stats_search(struct deflate_stats *stats, int probes) {
+    stats->searches += 1;
+    stats->probes += probes;
+    stats->chain_histogram[probes == 0 ? 0 : 32 - __builtin_clz(probes)] += 1;
+}
+
+static inline uint64_t stats_clock(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+#else
+#define STATS(stats, statement) do { } while (0)
+#endif
+#endif